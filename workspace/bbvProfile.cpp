@@ -0,0 +1,145 @@
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <vector>
+#include "pin.H"
+using std::cerr;
+using std::endl;
+using std::map;
+using std::ofstream;
+using std::string;
+using std::vector;
+
+/**************************************
+ * Basic-block-vector profiler
+ * 每隔固定条数的指令输出一行BBV (SimPoint的.bb格式):
+ *   T:<bbl id>:<该BBL执行的指令数> :<bbl id>:<count> ...
+ * 输出文件交给simPoint.py做聚类, 得到.simpoints和.weights
+**************************************/
+
+ofstream OutFile;
+
+// Per-BBL counter, shared by every trace that contains the same block
+struct BblCount
+{
+    UINT64 count;           // 当前区间内该BBL执行的指令数
+    UINT32 id;              // 从1开始编号
+    bool listed;            // 是否已在touchedBbls中
+};
+
+map<ADDRINT, BblCount*> bblCounts;
+vector<BblCount*> touchedBbls;  // 当前区间内执行过的BBL
+UINT32 nextBblId = 1;
+
+UINT64 interval;
+INT64 intervalLeft;             // 当前区间剩余的指令数
+UINT64 intervalNum = 0;
+
+// Write out the vector of the current interval and clear it
+VOID endInterval()
+{
+    OutFile << "T";
+    for (UINT32 i = 0; i < touchedBbls.size(); i++)
+    {
+        BblCount* b = touchedBbls[i];
+        OutFile << ":" << b->id << ":" << b->count << " ";
+        b->count = 0;
+        b->listed = false;
+    }
+    OutFile << endl;
+
+    touchedBbls.clear();
+    intervalNum++;
+    intervalLeft += interval;
+}
+
+VOID PIN_FAST_ANALYSIS_CALL countBbl(BblCount* b, UINT32 ninst)
+{
+    if (!b->listed)
+    {
+        b->listed = true;
+        touchedBbls.push_back(b);
+    }
+    b->count += ninst;
+}
+
+ADDRINT PIN_FAST_ANALYSIS_CALL intervalCountdown(UINT32 ninst)
+{
+    intervalLeft -= ninst;
+    return intervalLeft <= 0;
+}
+
+// Pin calls this function every time a new trace is encountered
+VOID Trace(TRACE trace, VOID *v)
+{
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        BblCount*& b = bblCounts[BBL_Address(bbl)];
+        if (b == NULL)
+        {
+            b = new BblCount();
+            b->count = 0;
+            b->id = nextBblId++;
+            b->listed = false;
+        }
+
+        BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)countBbl, IARG_FAST_ANALYSIS_CALL,
+                       IARG_PTR, b, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+        BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)intervalCountdown, IARG_FAST_ANALYSIS_CALL,
+                         IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+        BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)endInterval, IARG_END);
+    }
+}
+
+// This knob sets the output file name
+KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o", "bbvProfile.bb", "specify the output file name");
+
+// This knob sets the interval length, which must match -spi of cacheModel/brchPredict
+KNOB<UINT64> KnobInterval(KNOB_MODE_WRITEONCE, "pintool", "interval", "100000000", "specify the number of instructions per interval");
+
+// This function is called when the application exits
+VOID Fini(INT32 code, VOID *v)
+{
+    // The last, partial interval is dropped as SimPoint does
+    OutFile.close();
+    cerr << "bbvProfile: " << intervalNum << " intervals of " << interval << " instructions, "
+         << bblCounts.size() << " basic blocks" << endl;
+}
+
+/* ===================================================================== */
+/* Print Help Message                                                    */
+/* ===================================================================== */
+
+INT32 Usage()
+{
+    cerr << "This tool collects basic-block vectors per fixed instruction interval" << endl;
+    cerr << endl << KNOB_BASE::StringKnobSummary() << endl;
+    return -1;
+}
+
+/* ===================================================================== */
+/* Main                                                                  */
+/* ===================================================================== */
+/*   argc, argv are the entire command line: pin -t <toolname> -- ...    */
+/* ===================================================================== */
+
+int main(int argc, char * argv[])
+{
+    // Initialize pin
+    if (PIN_Init(argc, argv)) return Usage();
+
+    OutFile.open(KnobOutputFile.Value().c_str());
+    interval = KnobInterval.Value();
+    intervalLeft = interval;
+
+    // Register Trace to be called to instrument basic blocks
+    TRACE_AddInstrumentFunction(Trace, 0);
+
+    // Register Fini to be called when the application exits
+    PIN_AddFiniFunction(Fini, 0);
+
+    // Start the program, never returns
+    PIN_StartProgram();
+
+    return 0;
+}
@@ -1,14 +1,23 @@
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <iostream>
 #include <fstream>
 #include <cassert>
+#include <cmath>
 #include <stdarg.h>
 #include <cstdlib>
 #include <cstring>
+#include <string>
+#include <vector>
 #include <types.h>
 #include "pin.H"
+#include "phaseCtrl.h"
+#include "checkpoint.h"
+#include "brchPredictor.h"
+#include "brchTrace.h"
+#include "brchTarget.h"
 
 using namespace std;
 
@@ -22,536 +31,873 @@ typedef unsigned __int128   UINT128;
 
 ofstream OutFile;
 
-// 将val截断, 使其宽度变成bits
-#define truncate(val, bits) (((UINT128)val) & (((UINT128)1 << ((UINT128)bits)) - (UINT128)1))
+/* ===================================================================== */
+/* Per-branch statistics                                                 */
+/* ===================================================================== */
+// 每条静态分支一项, 以PC为键的线性探测开放寻址表, 装载率超过一半时翻倍
+// 熵: 每次执行按此前同一上下文中的结果计数估计概率 (KT估计), -log2 p的平均值收敛到条件熵.
+// 上下文为 (PC, 局部历史) 和 (PC, 全局历史), 计数放在固定大小的哈希表中, 冲突的上下文合并, 结果偏大
+class BranchStatsTable
+{
+public:
+    static const UINT32 NPROVIDERS = 16;    // provider下标 >= 15的计入最后一项
+    static const UINT32 LOCAL_BITS = 8;     // 条件熵所用的局部/全局历史长度
+    static const UINT32 GLOBAL_BITS = 12;
+    static const UINT32 SKETCH_LOG = 16;    // 每个计数表的项数的对数
 
-static UINT64 takenCorrect = 0;
-static UINT64 takenIncorrect = 0;
-static UINT64 notTakenCorrect = 0;
-static UINT64 notTakenIncorrect = 0;
+    struct Entry
+    {
+        ADDRINT pc;                         // 0为空
+        UINT64 execs;
+        UINT64 mispreds;
+        UINT64 taken;
+        UINT32 providers[NPROVIDERS];       // 各provider给出预测的次数
+        double bits[3];                     // 编码长度之和: 无上下文, 局部历史, 全局历史
+        UINT32 lhist;
+    };
+
+    BranchStatsTable() : m_mask(1023), m_size(0), m_ghist(0)
+    {
+        m_entries = new Entry[m_mask + 1];
+        memset(m_entries, 0, sizeof(Entry) * (m_mask + 1));
+        memset(m_sketch, 0, sizeof(m_sketch));
+    }
 
-// 饱和计数器 (N < 64)
-class SaturatingCnt
-{
-    size_t m_wid;
-    UINT8 m_val;
-    const UINT8 m_init_val;
+    ~BranchStatsTable() { delete[] m_entries; }
 
-    public:
-        SaturatingCnt(size_t width = 2) : m_init_val((1 << width) / 2)
+    void record(ADDRINT pc, bool taken, bool mispred, int provider)
+    {
+        Entry* e = find(pc);
+        if (e->pc == 0)
         {
-            m_wid = width;
-            m_val = m_init_val;
+            if (2 * (m_size + 1) > m_mask + 1)
+            {
+                grow();
+                e = find(pc);
+            }
+            e->pc = pc;
+            m_size++;
         }
+        e->bits[0] += codeLength(taken ? e->taken : e->execs - e->taken, e->execs);
+        e->bits[1] += sketchCodeLength(m_sketch[0][hashContext(pc, e->lhist)], taken);
+        e->bits[2] += sketchCodeLength(m_sketch[1][hashContext(pc, m_ghist)], taken);
+        e->lhist = ((e->lhist << 1) | taken) & ((1 << LOCAL_BITS) - 1);
+        m_ghist = ((m_ghist << 1) | taken) & ((1 << GLOBAL_BITS) - 1);
+
+        e->execs++;
+        e->mispreds += mispred;
+        e->taken += taken;
+        e->providers[provider < (int)NPROVIDERS ? provider : NPROVIDERS - 1]++;
+    }
+
+    void clear()
+    {
+        memset(m_entries, 0, sizeof(Entry) * (m_mask + 1));
+        m_size = 0;
+    }
 
-        void increase() { if (m_val < (1 << m_wid) - 1) m_val++; }
-        void decrease() { if (m_val > 0) m_val--; }
+    // Add the counts of another table, used to merge per-thread tables
+    void merge(BranchStatsTable& other)
+    {
+        vector<const Entry*> v = other.entries();
+        for (size_t k = 0; k < v.size(); k++)
+        {
+            Entry* e = find(v[k]->pc);
+            if (e->pc == 0)
+            {
+                if (2 * (m_size + 1) > m_mask + 1)
+                {
+                    grow();
+                    e = find(v[k]->pc);
+                }
+                e->pc = v[k]->pc;
+                m_size++;
+            }
+            e->execs += v[k]->execs;
+            for (int h = 0; h < 3; h++) e->bits[h] += v[k]->bits[h];
+            e->mispreds += v[k]->mispreds;
+            e->taken += v[k]->taken;
+            for (UINT32 p = 0; p < NPROVIDERS; p++) e->providers[p] += v[k]->providers[p];
+        }
+    }
 
-        void reset() { m_val = m_init_val; }
-        UINT8 getVal() { return m_val; }
+    // Return the occupied entries
+    vector<const Entry*> entries()
+    {
+        vector<const Entry*> v;
+        for (size_t i = 0; i <= m_mask; i++)
+            if (m_entries[i].pc) v.push_back(&m_entries[i]);
+        return v;
+    }
 
-        bool isTaken() { return (m_val > (1 << m_wid)/2 - 1); }
-};
+private:
+    Entry* m_entries;
+    size_t m_mask;                          // 容量 - 1, 容量为2的幂
+    size_t m_size;
+    UINT32 m_ghist;
+    UINT16 m_sketch[2][1 << SKETCH_LOG][2];     // [局部/全局][上下文][not taken, taken]的计数
 
-// 移位寄存器 (N < 128)
-class ShiftReg
-{
-    size_t m_wid;
-    UINT128 m_val;
+    static size_t hashContext(ADDRINT pc, UINT32 hist)
+    {
+        return ((pc ^ ((UINT64)hist << 32)) * 0x9e3779b97f4a7c15ULL) >> (64 - SKETCH_LOG);
+    }
 
-    public:
-        ShiftReg(size_t width) : m_wid(width), m_val(0) {}
+    static double codeLength(UINT64 same, UINT64 total) { return -log2((same + 0.5) / (total + 1.0)); }
 
-        bool shiftIn(bool b)
+    // 计数满时减半, 同时让估计跟随行为的变化
+    static double sketchCodeLength(UINT16* cnt, bool taken)
+    {
+        double len = codeLength(cnt[taken], cnt[0] + cnt[1]);
+        if (++cnt[taken] == 0xffff)
         {
-            bool ret = !!(m_val & (1 << (m_wid - 1)));
-            m_val <<= 1;
-            m_val |= b;
-            if(m_wid < 128) m_val &= ((UINT128)1 << (UINT128)m_wid) - (UINT128)1;
-            return ret;
+            cnt[0] >>= 1;
+            cnt[1] >>= 1;
         }
+        return len;
+    }
 
-        UINT128 getVal() { return m_val; }
-};
+    Entry* find(ADDRINT pc)
+    {
+        size_t i = (pc * 0x9e3779b97f4a7c15ULL) >> 20 & m_mask;
+        while (m_entries[i].pc != pc && m_entries[i].pc != 0) i = (i + 1) & m_mask;
+        return &m_entries[i];
+    }
 
-// Hash functions
-inline UINT128 f_xor(UINT128 a, UINT128 b) { return a ^ b; }
-// inline UINT128 f_xor1(UINT128 a, UINT128 b) { return a & b; }
-inline UINT128 f_xnor(UINT128 a, UINT128 b) { return a ^ b; }
+    void grow()
+    {
+        Entry* old = m_entries;
+        size_t old_cap = m_mask + 1;
+        m_mask = 2 * old_cap - 1;
+        m_entries = new Entry[m_mask + 1];
+        memset(m_entries, 0, sizeof(Entry) * (m_mask + 1));
+        for (size_t i = 0; i < old_cap; i++)
+            if (old[i].pc) *find(old[i].pc) = old[i];
+        delete[] old;
+    }
+};
 
+// 置信度分类: JRS和预测器自带的估计器各把每次预测分为高/低置信度两类
+struct ConfidenceStats
+{
+    JRSConfidence jrs;
+    UINT64 counts[2][2][2];     // [0 JRS, 1 预测器自带][0 低, 1 高][0 预测正确, 1 错误]
+};
 
-// Base class of all predictors
-class BranchPredictor
+// 每个预测器配置一个slot, 都由同一条分支流驱动
+struct PredictorSlot
 {
-    public:
-        BranchPredictor() {}
-        virtual ~BranchPredictor() {}
-        virtual bool predict(ADDRINT addr) { return false; };
-        virtual void update(bool takenActually, bool takenPredicted, ADDRINT addr) {};
+    string spec;
+    BranchPredictor* bp;
+    UINT64 counters[4];         // takenCorrect, takenIncorrect, notTakenCorrect, notTakenIncorrect
+    double acc[4];              // SimPoint加权累加的计数器
+    bool* preds;                // runBatch的输出
+    BranchStatsTable* perBranch;    // -bstats给出时只为第一个slot统计, 否则为NULL
+    ConfidenceStats* conf;          // -conf为1时统计, 否则为NULL
 };
 
-BranchPredictor* BP;
+vector<PredictorSlot> slots;
+
+// 同一时刻只有一个线程的缓冲区被送入slots中的预测器
+PIN_LOCK bpLock;
+BrchTraceWriter trace;          // -trace给出时记录预热和测量阶段的所有分支, 供brchReplay离线回放
+TargetModel* targets;           // BTB, RAS和ITTAGE, 在应用线程中运行
+
+UINT64 measureStart = 0;        // 测量开始时的指令位置, 用于MPKI
+double accInstructions = 0;
 
-template<UINT128 (*hash)(UINT128 addr, UINT128 history)>
-UINT128 fold(UINT128 a,int alen,UINT128 b, int blen, int flen)
+// Predict a batch with one predictor and count the outcomes; perBranch and conf may be NULL
+void runPredictor(BranchPredictor* bp, BranchStatsTable* perBranch, ConfidenceStats* conf, bool* preds,
+                  UINT64* counters, const BranchRecord* recs, UINT64 n)
 {
-    UINT128 ret = truncate(a,flen);
-    for (int i = flen; i+flen < alen; i += flen)
+    if (perBranch || conf)
     {
-        ret = hash(truncate(a >> i,flen),ret);
+        // 需要每次预测的provider和置信度, 逐条调用
+        for (UINT64 i = 0; i < n; i++)
+        {
+            preds[i] = bp->predict(recs[i].pc);
+            int provider = bp->provider();
+            bool jrsHigh = conf && conf->jrs.highConfidence(recs[i].pc);
+            bool nativeHigh = conf && bp->highConfidence();
+            bp->update(recs[i].taken, preds[i], recs[i].pc);
+
+            bool mispred = preds[i] != recs[i].taken;
+            if (perBranch) perBranch->record(recs[i].pc, recs[i].taken, mispred, provider);
+            if (conf)
+            {
+                conf->counts[0][jrsHigh][mispred]++;
+                if (bp->hasConfidence()) conf->counts[1][nativeHigh][mispred]++;
+                conf->jrs.update(!mispred, recs[i].taken);
+            }
+        }
+    }
+    else
+    {
+        bp->runBatch(recs, n, preds);
     }
 
-    for (int i = 0; i+flen < blen; i += flen)
+    for (UINT64 i = 0; i < n; i++)
     {
-        ret = hash(truncate(b >> i,flen),ret);
+        if (preds[i])
+        {
+            if (recs[i].taken)
+                counters[0]++;
+            else
+                counters[1]++;
+        }
+        else
+        {
+            if (recs[i].taken)
+                counters[3]++;
+            else
+                counters[2]++;
+        }
     }
-    
-    // printf("a:%#llx, ",a);
-    // printf("alen:%d, ",alen);
-    // printf("b:%#llx, ",b);
-    // printf("blen:%d, ",blen);
-    // printf("fold:%#llx, ",ret);
-    // printf("len:%d\n",flen);
-    return ret;
 }
 
-
+void runSlot(PredictorSlot& s, const BranchRecord* recs, UINT64 n)
+{
+    runPredictor(s.bp, s.perBranch, s.conf, s.preds, s.counters, recs, n);
+}
 
 /* ===================================================================== */
-/* BHT-based branch predictor                                            */
+/* Per-thread state                                                      */
 /* ===================================================================== */
-class BHTPredictor: public BranchPredictor
+// -tmode: shared  所有线程共享slots中的预测器, 各线程的分支按缓冲区交错进入同一个历史
+//         history 共享表, 每个线程有自己的全局历史, 切换线程时换入换出
+//         private 每个线程一套预测器和计数器, 在本线程中预测, 不经过bpLock
+enum ThreadMode { TM_SHARED, TM_HISTORY, TM_PRIVATE };
+ThreadMode threadMode = TM_SHARED;
+
+// 每个slot的计数器独占一条cache line
+struct PaddedCounters
 {
-    size_t m_entries_log;
-    SaturatingCnt* m_scnt;              // BHT
-    allocator<SaturatingCnt> m_alloc;
-    
-    public:
-        // Constructor
-        // param:   entry_num_log:  BHT行数的对数
-        //          scnt_width:     饱和计数器的位数, 默认值为2
-        BHTPredictor(size_t entry_num_log, size_t scnt_width = 2)
-        {
-            m_entries_log = entry_num_log;
-
-            m_scnt = m_alloc.allocate(1 << entry_num_log);      // Allocate memory for BHT
-            for (int i = 0; i < (1 << entry_num_log); i++)
-                m_alloc.construct(m_scnt + i, scnt_width);      // Call constructor of SaturatingCnt
-        }
+    UINT64 c[4];
+    UINT8 pad[64 - 4 * sizeof(UINT64)];
+};
 
-        // Destructor
-        ~BHTPredictor()
-        {
-            for (int i = 0; i < (1 << m_entries_log); i++)
-                m_alloc.destroy(m_scnt + i);
+struct ThreadState
+{
+    THREADID tid;
+    PIN_LOCK lock;                      // private: 本线程预测时和阶段回调读写计数器时持有, 几乎没有竞争
+    vector<BranchPredictor*> bps;       // private: 每个slot一个预测器
+    UINT8* counterMem;
+    PaddedCounters* counters;           // private: 每个slot的计数器, 按64字节对齐
+    BranchStatsTable* perBranch;        // private: 第一个预测器的逐分支统计, 输出时合并
+    vector<ConfidenceStats*> conf;      // private: 每个slot的置信度统计, 输出时合并
+    BranchRecord* conds;                // private: 本线程的条件分支
+    bool* preds;
+    UINT64 cap;
+    vector<UINT8*> hist;                // history: 每个slot的私有历史
+};
 
-            m_alloc.deallocate(m_scnt, 1 << m_entries_log);
-        }
+TLS_KEY tlsKey;
+vector<ThreadState*> threadStates;      // 所有线程, 包括已退出的, 由bpLock保护
+ThreadState* histOwner = NULL;          // history: slots中当前是哪个线程的历史
 
-        BOOL predict(ADDRINT addr)
+ThreadState* newThreadState(THREADID tid)
+{
+    ThreadState* ts = new ThreadState();
+    ts->tid = tid;
+    PIN_InitLock(&ts->lock);
+    ts->counterMem = NULL;
+    ts->counters = NULL;
+    ts->perBranch = NULL;
+    ts->conds = NULL;
+    ts->preds = NULL;
+    ts->cap = 0;
+    if (threadMode == TM_PRIVATE)
+    {
+        for (size_t i = 0; i < slots.size(); i++) ts->bps.push_back(newPredictor(slots[i].spec));
+        ts->counterMem = new UINT8[sizeof(PaddedCounters) * (slots.size() + 1)];
+        ts->counters = (PaddedCounters*)(((ADDRINT)ts->counterMem + 63) & ~(ADDRINT)63);
+        memset(ts->counters, 0, sizeof(PaddedCounters) * slots.size());
+        if (slots[0].perBranch) ts->perBranch = new BranchStatsTable();
+        for (size_t i = 0; i < slots.size(); i++) ts->conf.push_back(slots[i].conf ? new ConfidenceStats() : NULL);
+    }
+    if (threadMode == TM_HISTORY)
+    {
+        for (size_t i = 0; i < slots.size(); i++)
         {
-            //get hash
-            int tag = truncate(addr, m_entries_log);
-
-            return m_scnt[tag].isTaken();
+            size_t size = slots[i].bp->historySize();
+            ts->hist.push_back(size ? new UINT8[size] : NULL);
+            if (size) memset(ts->hist[i], 0, size);     // 全0为空历史
         }
+    }
+    threadStates.push_back(ts);
+    return ts;
+}
 
-        void update(BOOL takenActually, BOOL takenPredicted, ADDRINT addr)
-        {
-            // TODO: Update BHT according to branch results and prediction
+void deleteThreadState(ThreadState* ts)
+{
+    for (size_t i = 0; i < ts->bps.size(); i++) delete ts->bps[i];
+    for (size_t i = 0; i < ts->hist.size(); i++) delete[] ts->hist[i];
+    for (size_t i = 0; i < ts->conf.size(); i++) delete ts->conf[i];
+    delete[] ts->counterMem;
+    delete ts->perBranch;
+    delete[] ts->conds;
+    delete[] ts->preds;
+    delete ts;
+}
 
-            //get hash
-            int tag = truncate(addr, m_entries_log);
+// Find the state restored from a checkpoint for tid, or create one
+VOID ThreadStart(THREADID tid, CONTEXT* ctxt, INT32 flags, VOID* v)
+{
+    if (threadMode == TM_SHARED) return;
+    PIN_GetLock(&bpLock, tid + 1);
+    ThreadState* ts = NULL;
+    for (size_t i = 0; i < threadStates.size() && ts == NULL; i++)
+        if (threadStates[i]->tid == tid) ts = threadStates[i];
+    if (ts == NULL) ts = newThreadState(tid);
+    PIN_ReleaseLock(&bpLock);
+    PIN_SetThreadData(tlsKey, ts, tid);
+}
 
-            if(takenActually) {
-                (m_scnt[tag]).increase();
-            } else {
-                (m_scnt[tag]).decrease();
-            }
-        }
-};
+// history: put the history of ts into the shared predictors; only called while no batch is in flight
+void switchHistory(ThreadState* ts)
+{
+    if (ts == histOwner) return;
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        if (ts->hist[i] == NULL) continue;
+        if (histOwner) slots[i].bp->getHistory(histOwner->hist[i]);
+        slots[i].bp->setHistory(ts->hist[i]);
+    }
+    histOwner = ts;
+}
+
+// private: predict a buffer with the thread's own predictors
+void runPrivate(ThreadState* ts, const BranchRecord* recs, UINT64 n)
+{
+    PIN_GetLock(&ts->lock, ts->tid + 1);
+    if (n > ts->cap)
+    {
+        ts->cap = n;
+        delete[] ts->conds;
+        delete[] ts->preds;
+        ts->conds = new BranchRecord[n];
+        ts->preds = new bool[n];
+    }
+    UINT64 m = 0;
+    for (UINT64 i = 0; i < n; i++)
+        if (recs[i].type == BR_COND) ts->conds[m++] = recs[i];
+    for (size_t i = 0; i < ts->bps.size(); i++)
+        runPredictor(ts->bps[i], i == 0 ? ts->perBranch : NULL, ts->conf[i], ts->preds, ts->counters[i].c, ts->conds, m);
+    PIN_ReleaseLock(&ts->lock);
+}
 
 /* ===================================================================== */
-/* Global-history-based branch predictor                                 */
+/* Worker threads                                                        */
 /* ===================================================================== */
-template<UINT128 (*hash1)(UINT128 pc, UINT128 ghr), UINT128 (*hash2)(UINT128 pc, UINT128 ghr)>
-class GlobalHistoryPredictor: public BranchPredictor
-{
-    ShiftReg* m_ghr;                   // GHR
-    size_t m_ghr_size;
-    size_t m_tag_size;
-    SaturatingCnt* m_scnt;              // PHT中的分支历史字段
-    size_t m_entries_log;                   // PHT行数的对数
-    allocator<SaturatingCnt> m_alloc;
-    UINT128* m_tags;
-    
-    public:
-        // Constructor
-        // param:   ghr_width:      Width of GHR
-        //          entry_num_log:  PHT表行数的对数
-        //          scnt_width:     饱和计数器的位数, 默认值为2
-        GlobalHistoryPredictor(size_t ghr_width, size_t entry_num_log,size_t tag_size ,size_t scnt_width = 2)
-        {
-            m_ghr = new ShiftReg(ghr_width);
-            m_ghr_size = ghr_width;
-            m_tag_size = tag_size;
-            m_entries_log = entry_num_log;
-            m_tags = new UINT128[1 << entry_num_log];
-            memset(m_tags,0,sizeof(UINT128)*(1<<entry_num_log));
-
-            m_scnt = m_alloc.allocate(1 << entry_num_log);      // Allocate memory for BHT
-            for (int i = 0; i < (1 << entry_num_log); i++)
-                m_alloc.construct(m_scnt + i, scnt_width);      // Call constructor of SaturatingCnt
-        }
+// 每个缓冲区的条件分支复制到batch后交给所有worker, worker i负责第i, i + W, i + 2W, ...个slot.
+// 应用线程只需等待上一个batch完成, 下一个缓冲区的填充与预测并行.
+struct Worker
+{
+    UINT32 id;
+    PIN_SEMAPHORE go;
+    PIN_SEMAPHORE done;
+    PIN_THREAD_UID uid;
+};
 
-        // Destructor
-        ~GlobalHistoryPredictor()
-        {
-            for (int i = 0; i < (1 << m_entries_log); i++)
-                m_alloc.destroy(m_scnt + i);
+vector<Worker*> workers;
+BranchRecord* batch;            // 当前交给worker的分支
+UINT64 batchLen;
+UINT64 batchCap;                // batch和各slot的preds的容量
+volatile bool stopping = false;
 
-            m_alloc.deallocate(m_scnt, 1 << m_entries_log);
-            delete m_ghr;
-            delete[] m_tags;
-        }
+VOID workerMain(VOID* v)
+{
+    Worker* w = (Worker*)v;
+    while (true)
+    {
+        PIN_SemaphoreWait(&w->go);
+        PIN_SemaphoreClear(&w->go);
+        if (stopping) break;
+        for (size_t i = w->id; i < slots.size(); i += workers.size())
+            runSlot(slots[i], batch, batchLen);
+        PIN_SemaphoreSet(&w->done);
+    }
+}
 
-        // Only for TAGE: return a tag according to the specificed address
-        UINT128 get_tag(ADDRINT addr)
-        {
-            return m_tags[getIdx(addr)];
-        }
+// Wait until the workers have finished the current batch; the counters are stable afterwards
+void waitWorkers()
+{
+    for (size_t i = 0; i < workers.size(); i++) PIN_SemaphoreWait(&workers[i]->done);
+}
 
-        // Only for TAGE: return GHR's value
-        UINT128 get_ghr()
-        {
-            return m_ghr->getVal();
-        }
+// Make sure batch and the preds of every slot hold n records; only called while no batch is in flight
+void reserveBatch(UINT64 n)
+{
+    if (n <= batchCap) return;
+    batchCap = n;
+    delete[] batch;
+    batch = new BranchRecord[batchCap];
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        delete[] slots[i].preds;
+        slots[i].preds = new bool[batchCap];
+    }
+}
 
-        size_t get_ghr_size()
-        {
-            return m_ghr_size;
-        }
+// Pin calls this function when a thread's branch buffer is full or the thread exits
+VOID* consumeBranches(BUFFER_ID id, THREADID tid, const CONTEXT* ctxt, VOID* buf, UINT64 n, VOID* v)
+{
+    const BranchRecord* recs = (const BranchRecord*)buf;
 
-        void shift_ghr(bool taken)
-        {
-            m_ghr->shiftIn(taken);
-        }
+    PIN_GetLock(&bpLock, tid + 1);
+    trace.append(recs, n);
+    targets->run(recs, n);
 
-        void updateTag(ADDRINT addr){
-            int idx = getIdx(addr);
-            UINT128 new_tag = gen_tag(addr);
-            m_tags[idx] = new_tag;
-        }
+    if (threadMode == TM_PRIVATE)
+    {
+        PIN_ReleaseLock(&bpLock);
+        runPrivate((ThreadState*)PIN_GetThreadData(tlsKey, tid), recs, n);
+        return buf;
+    }
 
-        // Only for TAGE: reset a saturating counter to default value (which is weak taken)
-        void reset_ctr(ADDRINT addr)
-        {
-            //int tag = truncate(hash(addr, m_ghr->getVal()),m_entries_log);
-            (m_scnt[getIdx(addr)]).reset();
-        }
+    // 方向预测器只看条件分支; Pin重用buf, 所以复制到batch
+    waitWorkers();
+    if (threadMode == TM_HISTORY) switchHistory((ThreadState*)PIN_GetThreadData(tlsKey, tid));
+    reserveBatch(n);
+    batchLen = 0;
+    for (UINT64 i = 0; i < n; i++)
+        if (recs[i].type == BR_COND) batch[batchLen++] = recs[i];
 
-        bool predict(ADDRINT addr)
+    if (workers.empty() || stopping)
+    {
+        for (size_t i = 0; i < slots.size(); i++) runSlot(slots[i], batch, batchLen);
+    }
+    else
+    {
+        for (size_t i = 0; i < workers.size(); i++)
         {
-            return (m_scnt[getIdx(addr)]).isTaken();
+            PIN_SemaphoreClear(&workers[i]->done);
+            PIN_SemaphoreSet(&workers[i]->go);
         }
+    }
+    PIN_ReleaseLock(&bpLock);
 
-        void update(bool takenActually, bool takenPredicted, ADDRINT addr)
-        {
-            //update BHT
-            // int tag = truncate(hash(addr, m_ghr->getVal()),m_entries_log);
-            int idx = getIdx(addr);
-            // UINT128 new_tag = gen_tag(addr);
-            
-            if(takenActually) {
-                (m_scnt[idx]).increase();
-            } else {
-                (m_scnt[idx]).decrease();
-            }
-            
-            // m_tags[idx] = new_tag;
+    return buf;
+}
 
-            //update ghr
-            m_ghr->shiftIn(takenActually);
+// Wait for the batch in flight and keep the next one from being handed out; pair with unlockSlots
+void lockSlots()
+{
+    PIN_GetLock(&bpLock, PIN_ThreadId() + 1);
+    waitWorkers();
+}
 
-            // printf("%d\n",(int)(m_ghr->getVal()));
-        }
-    
-        int getIdx(ADDRINT addr)
-        {
-            // return truncate(hash(addr,m_ghr->getVal()),m_entries_log);
-            return truncate(fold<hash1>(m_ghr->getVal(),m_ghr_size,addr,64,m_entries_log) ,m_entries_log);
-        }
+void unlockSlots() { PIN_ReleaseLock(&bpLock); }
 
-        UINT128 gen_tag(ADDRINT addr)
-        {
-            return truncate(fold<hash2>(m_ghr->getVal(),m_ghr_size,addr,64,m_tag_size) ,m_tag_size);
-        }
-};
+BUFFER_ID brchBuf;
 
-/* ===================================================================== */
-/* Tournament predictor: Select output by global/local selection history */
-/* ===================================================================== */
-class TournamentPredictor: public BranchPredictor
+UINT32 branchType(INS ins)
 {
-    BranchPredictor* m_BPs[2];      // Sub-predictors
-    SaturatingCnt* m_gshr;          // Global select-history register
+    if (INS_IsRet(ins)) return BR_RET;
+    if (INS_IsCall(ins)) return INS_IsDirectControlFlow(ins) ? BR_CALL : BR_ICALL;
+    if (INS_HasFallThrough(ins)) return BR_COND;
+    return INS_IsDirectControlFlow(ins) ? BR_JUMP : BR_INDIRECT;
+}
+
+// Pin calls this function every time a new instruction is encountered
+void Instruction(INS ins, void * v)
+{
+    if (!phaseCtrl.instrumenting()) return;
+
+    if (INS_IsControlFlow(ins) && !INS_IsSyscall(ins))
+    {
+        // One record per executed control-flow instruction, the direction is resolved before it executes
+        INS_InsertFillBuffer(ins, IPOINT_BEFORE, brchBuf,
+                             IARG_INST_PTR, offsetof(BranchRecord, pc),
+                             IARG_BRANCH_TARGET_ADDR, offsetof(BranchRecord, target),
+                             IARG_UINT32, branchType(ins), offsetof(BranchRecord, type),
+                             IARG_UINT32, (UINT32)INS_Size(ins), offsetof(BranchRecord, size),
+                             IARG_BRANCH_TAKEN, offsetof(BranchRecord, taken),
+                             IARG_END);
+    }
+}
+
+// This knob sets the output file name
+KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o", "brchPredict.txt", "specify the output file name");
+
+// This knob sets the size of each thread's branch buffer
+// 缓冲区中的记录在满或线程退出时才送入预测器, 阶段切换和detach时最多有一个缓冲区的分支计入相邻阶段或丢失
+KNOB<UINT32> KnobBufferPages(KNOB_MODE_WRITEONCE, "pintool", "bufpages", "64", "specify the number of 4KB pages in each thread's branch buffer");
+
+// This knob records the branches to a trace for brchReplay
+KNOB<string> KnobTrace(KNOB_MODE_WRITEONCE, "pintool", "trace", "", "specify a file to record the branches to, replayed offline by brchReplay");
 
-    public:
-        TournamentPredictor(BranchPredictor* BP0, BranchPredictor* BP1, size_t gshr_width = 2)
+// This knob gives the predictors to evaluate, may be repeated; see newPredictor in brchPredictor.h for the spec format
+KNOB<string> KnobPredictor(KNOB_MODE_APPEND, "pintool", "bp", "tage:tnum=8,t0=14,h1=2,alpha=2,log=11,tag=12",
+        "specify a predictor spec, e.g. bht:log=14, local:bht=10,hist=10, gshare:ghr=22,log=11 or tage:tnum=8,log=11");
+
+// These knobs enable the per-branch statistics of the first -bp spec
+KNOB<string> KnobBranchStats(KNOB_MODE_WRITEONCE, "pintool", "bstats", "", "specify a CSV file for per-branch statistics of the first predictor, empty to disable");
+KNOB<UINT32> KnobTopN(KNOB_MODE_WRITEONCE, "pintool", "topn", "20", "specify the number of hard-to-predict branches to print with -bstats");
+
+// This knob rates every prediction with JRS and the predictor's own confidence estimator
+KNOB<BOOL> KnobConfidence(KNOB_MODE_WRITEONCE, "pintool", "conf", "0", "report the branches and mispredictions in the high/low confidence classes");
+
+// These knobs configure the target predictors
+KNOB<UINT32> KnobBtbSets(KNOB_MODE_WRITEONCE, "pintool", "btb", "9", "specify the log2 of the number of BTB sets");
+KNOB<UINT32> KnobBtbWays(KNOB_MODE_WRITEONCE, "pintool", "btbw", "4", "specify the associativity of the BTB");
+KNOB<UINT32> KnobRasDepth(KNOB_MODE_WRITEONCE, "pintool", "ras", "16", "specify the number of RAS entries");
+KNOB<UINT32> KnobIttage(KNOB_MODE_WRITEONCE, "pintool", "ittage", "9", "specify the log2 of the entries per ITTAGE table, 0 for BTB only");
+
+// This knob decides how application threads share the predictors
+KNOB<string> KnobThreadMode(KNOB_MODE_WRITEONCE, "pintool", "tmode", "shared",
+        "specify shared (one predictor for all threads), history (shared tables, per-thread history) or private (per-thread predictors)");
+
+// This knob sets the number of worker threads the predictors are spread across
+KNOB<UINT32> KnobWorkers(KNOB_MODE_WRITEONCE, "pintool", "workers", "0", "specify the number of worker threads, 0 to predict in the application threads");
+
+// Clear the counters gathered during warm-up, the predictor state is kept
+void beginMeasure()
+{
+    lockSlots();
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        memset(slots[i].counters, 0, sizeof(slots[i].counters));
+        // 组件统计和逐分支统计不做SimPoint加权, 采样时覆盖所有模拟过的区间
+        if (!phaseCtrl.sampling())
         {
-            m_BPs[0] = BP0;
-            m_BPs[1] = BP1;
-            m_gshr = new SaturatingCnt(gshr_width);
+            slots[i].bp->resetStats();
+            if (slots[i].perBranch) slots[i].perBranch->clear();
+            if (slots[i].conf) memset(slots[i].conf->counts, 0, sizeof(slots[i].conf->counts));
         }
-
-        ~TournamentPredictor()
+    }
+    for (size_t t = 0; t < threadStates.size(); t++)
+    {
+        ThreadState* ts = threadStates[t];
+        PIN_GetLock(&ts->lock, PIN_ThreadId() + 1);
+        for (size_t i = 0; i < ts->bps.size(); i++)
         {
-            delete m_BPs[0];
-            delete m_BPs[1];
-            delete m_gshr;
+            memset(ts->counters[i].c, 0, sizeof(ts->counters[i].c));
+            if (!phaseCtrl.sampling()) ts->bps[i]->resetStats();
         }
+        if (ts->perBranch && !phaseCtrl.sampling()) ts->perBranch->clear();
+        for (size_t i = 0; i < ts->conf.size(); i++)
+            if (ts->conf[i] && !phaseCtrl.sampling()) memset(ts->conf[i]->counts, 0, sizeof(ts->conf[i]->counts));
+        PIN_ReleaseLock(&ts->lock);
+    }
+    targets->resetStats();
+    measureStart = phaseCtrl.position();
+    unlockSlots();
+}
 
-        bool predict(ADDRINT addr)
-        {
-            if (m_gshr->isTaken()) {
-                return m_BPs[1]->predict(addr);
-            } else {
-                return m_BPs[0]->predict(addr);
-            }
-        };
+// private: sum the per-thread counters into the slots
+void gatherCounters()
+{
+    if (threadMode != TM_PRIVATE) return;
+    for (size_t i = 0; i < slots.size(); i++) memset(slots[i].counters, 0, sizeof(slots[i].counters));
+    for (size_t t = 0; t < threadStates.size(); t++)
+    {
+        ThreadState* ts = threadStates[t];
+        PIN_GetLock(&ts->lock, PIN_ThreadId() + 1);
+        for (size_t i = 0; i < ts->bps.size(); i++)
+            for (int j = 0; j < 4; j++) slots[i].counters[j] += ts->counters[i].c[j];
+        PIN_ReleaseLock(&ts->lock);
+    }
+}
 
-        void update(bool takenActually, bool takenPredicted, ADDRINT addr)
-        {
-            //update gshr
-            if (m_BPs[1]->predict(addr) == takenActually && m_BPs[0]->predict(addr) != takenActually) {
-                m_gshr->increase();
-            } else if (m_BPs[1]->predict(addr) != takenActually && m_BPs[0]->predict(addr) == takenActually) {
-                m_gshr->decrease();
-            }
+// Accumulate the weighted counters of a simulation point
+void endRegion(double weight)
+{
+    lockSlots();
+    gatherCounters();
+    for (size_t i = 0; i < slots.size(); i++)
+        for (int j = 0; j < 4; j++) slots[i].acc[j] += weight * slots[i].counters[j];
+    targets->accumulate(weight);
+    accInstructions += weight * (phaseCtrl.position() - measureStart);
+    unlockSlots();
+}
 
-            //update sub BP
-            m_BPs[0]->update(takenActually, takenPredicted, addr);
-            m_BPs[1]->update(takenActually, takenPredicted, addr);
-        };
-};
+bool cmpMispreds(const BranchStatsTable::Entry* a, const BranchStatsTable::Entry* b)
+{
+    return a->mispreds > b->mispreds || (a->mispreds == b->mispreds && a->pc < b->pc);
+}
 
-/* ===================================================================== */
-/* TArget GEometric history length Predictor                             */
-/* ===================================================================== */
-template<UINT128 (*hash1)(UINT128 pc, UINT128 ghr), UINT128 (*hash2)(UINT128 pc, UINT128 ghr)>
-class TAGEPredictor: public BranchPredictor
-{
-    const size_t m_tnum;            // 子预测器个数 (T[0 : m_tnum - 1])
-    const size_t m_entries_log;     // 子预测器T[1 : m_tnum - 1]的PHT行数的对数
-    BranchPredictor** m_T;          // 子预测器指针数组
-    bool* m_T_pred;                 // 用于存储各子预测的预测值
-    UINT8** m_useful;               // usefulness matrix
-    int provider_indx;              // Provider's index of m_T
-    int altpred_indx;               // Alternate provider's index of m_T
-    size_t m_tag_size;
-    bool clear_high;
-
-    const size_t m_rst_period;      // Reset period of usefulness
-    size_t m_rst_cnt;               // Reset counter
-
-    public:
-        // Constructor
-        // param:   tnum:               The number of sub-predictors
-        //          T0_entry_num_log:   子预测器T0的BHT行数的对数
-        //          T1ghr_len:          子预测器T1的GHR位宽
-        //          alpha:              各子预测器T[1 : m_tnum - 1]的GHR几何倍数关系
-        //          Tn_entry_num_log:   各子预测器T[1 : m_tnum - 1]的PHT行数的对数
-        //          scnt_width:         Width of saturating counter (3 by default)
-        //          rst_period:         Reset period of usefulness
-        TAGEPredictor(size_t tnum, size_t T0_entry_num_log, size_t T1ghr_len, float alpha, size_t Tn_entry_num_log, size_t tag_size,size_t scnt_width = 3, size_t rst_period = 256*1024)
-        : m_tnum(tnum), m_entries_log(Tn_entry_num_log),m_tag_size(tag_size), m_rst_period(rst_period),m_rst_cnt(0)
+// CSV中的字符串加引号, 函数名可能含逗号
+string csvQuote(const string& str)
+{
+    string q = "\"";
+    for (size_t i = 0; i < str.size(); i++)
+    {
+        if (str[i] == '"') q += '"';
+        q += str[i];
+    }
+    return q + "\"";
+}
+
+// Write all branches of a slot to -bstats sorted by mispredictions, and print the top -topn ones
+void dumpBranchStats(PredictorSlot& s)
+{
+    vector<const BranchStatsTable::Entry*> v = s.perBranch->entries();
+    sort(v.begin(), v.end(), cmpMispreds);
+
+    ofstream csv(KnobBranchStats.Value().c_str());
+    csv << "pc,function,file,line,execs,mispreds,mispredRate,takenRate,entropy,localEntropy,globalEntropy";
+    for (UINT32 p = 0; p < BranchStatsTable::NPROVIDERS; p++) csv << ",provider" << p;
+    csv << endl;
+
+    char line[1024];
+    string header = "Top hard-to-predict branches of " + s.spec;
+    cout << header << endl;
+    OutFile << header << endl;
+    snprintf(line, sizeof(line), "%4s %18s %12s %14s %9s %7s %8s %5s %5s %5s  %s",
+             "rank", "pc", "mispreds", "execs", "mispred%", "taken%", "provider", "H", "H|l", "H|g", "location");
+    cout << line << endl;
+    OutFile << line << endl;
+
+    // 条件熵高于UNPREDICTABLE_BITS的分支即使预测器足够好也难以预测
+    const double UNPREDICTABLE_BITS = 0.5;
+    UINT64 allExecs = 0, hardExecs = 0, hardBranches = 0;
+
+    PIN_LockClient();
+    for (size_t i = 0; i < v.size(); i++)
+    {
+        const BranchStatsTable::Entry* e = v[i];
+        double h[3];
+        for (int k = 0; k < 3; k++) h[k] = e->execs ? e->bits[k] / e->execs : 0;
+        double hMin = min(h[1], h[2]);
+        allExecs += e->execs;
+        if (hMin > UNPREDICTABLE_BITS)
         {
-            m_T = new BranchPredictor* [m_tnum];
-            m_T_pred = new bool [m_tnum];
-            m_useful = new UINT8* [m_tnum];
+            hardExecs += e->execs;
+            hardBranches++;
+        }
 
-            m_T[0] = new BHTPredictor(T0_entry_num_log);
+        INT32 col = 0, srcLine = 0;
+        string file;
+        PIN_GetSourceLocation(e->pc, &col, &srcLine, &file);
+        string func = RTN_FindNameByAddress(e->pc);
+        double mispredRate = e->execs ? double(e->mispreds) / e->execs : 0;
+        double takenRate = e->execs ? double(e->taken) / e->execs : 0;
 
-            size_t ghr_size = T1ghr_len;
-            clear_high = 1;
-            for (size_t i = 1; i < m_tnum; i++)
-            {
-                m_T[i] = new GlobalHistoryPredictor<hash1,hash2>(ghr_size, m_entries_log, m_tag_size,scnt_width);
-                ghr_size = (size_t)(ghr_size * alpha);
-                m_useful[i] = new UINT8 [1 << m_entries_log];
-                memset(m_useful[i], 0, sizeof(UINT8)*(1 << m_entries_log));
-                //memset(m_tags[i-1], 0, sizeof(UINT128)*(1 << m_entries_log));
-            }
-        }
+        csv << "0x" << hex << e->pc << dec << "," << csvQuote(func) << "," << csvQuote(file) << ","
+            << srcLine << "," << e->execs << "," << e->mispreds << "," << mispredRate << "," << takenRate
+            << "," << h[0] << "," << h[1] << "," << h[2];
+        for (UINT32 p = 0; p < BranchStatsTable::NPROVIDERS; p++) csv << "," << e->providers[p];
+        csv << endl;
 
-        ~TAGEPredictor()
+        if (i < KnobTopN.Value())
         {
-            for (size_t i = 0; i < m_tnum; i++) delete m_T[i];
-            for (size_t i = 0; i < m_tnum; i++) delete[] m_useful[i];
-
-            delete[] m_T;
-            delete[] m_T_pred;
-            delete[] m_useful;
+            UINT32 provider = max_element(e->providers, e->providers + BranchStatsTable::NPROVIDERS) - e->providers;
+            snprintf(line, sizeof(line), "%4lu %#18lx %12lu %14lu %9.2f %7.2f %8u %5.2f %5.2f %5.2f  %s %s:%d", i + 1, e->pc,
+                     e->mispreds, e->execs, 100 * mispredRate, 100 * takenRate, provider, h[0], h[1], h[2],
+                     func.empty() ? "?" : func.c_str(), file.empty() ? "?" : file.c_str(), srcLine);
+            cout << line << endl;
+            OutFile << line << endl;
         }
+    }
+    PIN_UnlockClient();
+    csv.close();
+
+    snprintf(line, sizeof(line), "%lu static branches (%.2f%% of dynamic) have more than %.1f bit of conditional entropy",
+             hardBranches, allExecs ? 100.0 * hardExecs / allExecs : 0.0, UNPREDICTABLE_BITS);
+    cout << line << endl;
+    OutFile << line << endl;
+}
 
-        bool predict(ADDRINT addr)
+// Print the high/low confidence classes of every slot
+void dumpConfidence()
+{
+    static const char* estimators[2] = { "JRS", "native" };
+    static const char* classes[2] = { "low", "high" };
+    char line[512];
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        ConfidenceStats* c = slots[i].conf;
+        if (c == NULL) continue;
+        // private模式下合并各线程的统计
+        for (size_t t = 0; t < threadStates.size(); t++)
         {
-            provider_indx = 0;
-            altpred_indx = 0;
-            
-            // from longest to shortest
-            for (int i = m_tnum - 1; i > 0; i--) {
-                UINT128 tag1 = ((GlobalHistoryPredictor<hash1,hash2>*)m_T[i])->get_tag(addr);
-                UINT128 tag2 = ((GlobalHistoryPredictor<hash1,hash2>*)m_T[i])->gen_tag(addr);
-                //UINT128 tag2 = hash1(addr,((GlobalHistoryPredictor<hash1>*)m_T[i])->get_ghr());
-                if (tag1 == tag2) {
-                    if (provider_indx == 0) provider_indx = i;
-                    else {
-                        altpred_indx = i;
-                        break;
-                    }
-                }
-            }
-            m_T_pred[provider_indx] = m_T[provider_indx]->predict(addr);
-            m_T_pred[altpred_indx] = m_T[altpred_indx]->predict(addr);
-            
-            
-            return m_T_pred[provider_indx];
+            ConfidenceStats* tc = i < threadStates[t]->conf.size() ? threadStates[t]->conf[i] : NULL;
+            if (tc == NULL) continue;
+            for (int k = 0; k < 8; k++) (&c->counts[0][0][0])[k] += (&tc->counts[0][0][0])[k];
         }
 
-        void update(bool takenActually, bool takenPredicted, ADDRINT addr)
+        string header = "Confidence of " + slots[i].spec;
+        cout << header << endl;
+        OutFile << header << endl;
+        snprintf(line, sizeof(line), "%-10s %-5s %14s %8s %12s %9s", "estimator", "class", "branches", "share%", "mispreds", "mispred%");
+        cout << line << endl;
+        OutFile << line << endl;
+        for (int e = 0; e < 2; e++)
         {
-            // if(provider_indx != 0) 
-            // {
-            //     GlobalHistoryPredictor<hash1,hash2>* BPQ = (GlobalHistoryPredictor<hash1,hash2>*)m_T[provider_indx];
-            //     // UINT128 GHP = BPQ->get_ghr();
-            //     // printf("%llu\n",BPQ->get_ghr());
-            //     // UINT128 GHP = ((UINT128)1 << 127) - (UINT128)1;
-                
-            //     printf("Prov:%d, Alt:%d,prid %d, take %d,",provider_indx,altpred_indx,takenPredicted,takenActually);
-            //     printf(" ghr:%llu\n",BPQ->get_ghr());
-            // }
-
-
-            // printf("Take %d\n",takenActually);
-            // TODO: Update usefulness
-            if(m_T_pred[provider_indx] != m_T_pred[altpred_indx]){
-                int idx = ((GlobalHistoryPredictor<hash1,hash2>*)m_T[provider_indx])->getIdx(addr);
-
-                if (takenPredicted == takenActually) {
-                    if(m_useful[provider_indx][idx] < 3) m_useful[provider_indx][idx]++;
-                } else {
-                    if(m_useful[provider_indx][idx] > 0) m_useful[provider_indx][idx]--;
-                }
-            }
-
-            // TODO: Entry replacement
-            bool allocated = false;
-            if (takenPredicted != takenActually) {
-                for (size_t i = provider_indx+1; i<m_tnum; i++) {
-                    int idx = ((GlobalHistoryPredictor<hash1,hash2>*)m_T[i])->getIdx(addr);
-                    if(m_useful[i][idx] == 0){
-                        ((GlobalHistoryPredictor<hash1,hash2>*)m_T[i])->updateTag(addr);
-                        ((GlobalHistoryPredictor<hash1,hash2>*)m_T[i])->reset_ctr(addr);
-                        allocated = true;
-                        break;
-                    }
-                }
-                if (!allocated) {
-                    for (size_t i = provider_indx+1; i<m_tnum; i++) {
-                        int getIdx = ((GlobalHistoryPredictor<hash1,hash2>*)m_T[i])->getIdx(addr);
-                        if(m_useful[i][getIdx] != 0) m_useful[i][getIdx]--;
-                    }
-                }
-            }
-
-            
-
-            // TODO: Reset usefulness periodically
-            m_rst_cnt++;
-            if (m_rst_cnt == m_rst_period)
+            UINT64 total = c->counts[e][0][0] + c->counts[e][0][1] + c->counts[e][1][0] + c->counts[e][1][1];
+            if (total == 0) continue;       // 预测器没有自带的估计器
+            for (int h = 1; h >= 0; h--)
             {
-                m_rst_cnt = 0;
-                for (size_t i = 1; i < m_tnum; i++)
-                    for (int j = 0; j < (1 << m_entries_log); j++)
-                        m_useful[i][j] &= (clear_high ? 2 : 1);
-                clear_high = !clear_high;
+                UINT64 n = c->counts[e][h][0] + c->counts[e][h][1];
+                snprintf(line, sizeof(line), "%-10s %-5s %14lu %8.2f %12lu %9.2f", estimators[e], classes[h], n,
+                         100.0 * n / total, c->counts[e][h][1], n ? 100.0 * c->counts[e][h][1] / n : 0.0);
+                cout << line << endl;
+                OutFile << line << endl;
             }
+        }
+    }
+}
 
-            // TODO: Update provider itself
-            // printf("Update %d\n",provider_indx);
-            m_T[provider_indx]-> update(takenActually, takenPredicted, addr);
+// Print the comparison table to stdout and the output file
+void dumpResults()
+{
+    lockSlots();
+    gatherCounters();
+    double instructions = phaseCtrl.position() - measureStart;
+    if (phaseCtrl.sampling())
+    {
+        cout << "Results reconstructed from " << phaseCtrl.numRegions()
+             << " simulation points (counts are per-interval estimates)" << endl;
+        for (size_t i = 0; i < slots.size(); i++)
+            for (int j = 0; j < 4; j++) slots[i].counters[j] = (UINT64)(slots[i].acc[j] + 0.5);
+        instructions = accInstructions;
+        targets->useAccumulated();
+    }
 
-            for (int i = 1; i < m_tnum; i++) {
-                if(i == provider_indx) continue;
-                ((GlobalHistoryPredictor<hash1,hash2>*)m_T[i]) -> shift_ghr(takenActually);
-            }
+    char line[512];
+    snprintf(line, sizeof(line), "%-48s %14s %14s %14s %14s %10s %8s %9s",
+             "predictor", "takenCorrect", "takenIncorrect", "notTakenCorrect", "notTakenIncorrect", "Precision", "MPKI", "KB");
+    cout << line << endl;
+    OutFile << line << endl;
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        const UINT64* c = slots[i].counters;
+        UINT64 total = c[0] + c[1] + c[2] + c[3];
+        double precision = total ? 100 * double(c[0] + c[2]) / total : 0;
+        double mpki = instructions > 0 ? 1000 * double(c[1] + c[3]) / instructions : 0;
+        snprintf(line, sizeof(line), "%-48s %14lu %14lu %14lu %14lu %10.4f %8.4f %9.2f",
+                 slots[i].spec.c_str(), c[0], c[1], c[2], c[3], precision, mpki, slots[i].bp->storageBits() / 8192.0);
+        cout << line << endl;
+        OutFile << line << endl;
+    }
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        // private模式下组件统计按线程输出
+        for (size_t t = 0; t < (threadMode == TM_PRIVATE ? threadStates.size() : 1); t++)
+        {
+            string extra = threadMode == TM_PRIVATE ? threadStates[t]->bps[i]->report() : slots[i].bp->report();
+            if (extra.empty()) continue;
+            string name = slots[i].spec;
+            if (threadMode == TM_PRIVATE) name += " (thread " + decstr(threadStates[t]->tid) + ")";
+            cout << name << endl << extra << endl;
+            OutFile << name << endl << extra << endl;
         }
+    }
 
-        
-};
+    if (slots[0].perBranch)
+    {
+        for (size_t t = 0; t < threadStates.size(); t++)
+            if (threadStates[t]->perBranch) slots[0].perBranch->merge(*threadStates[t]->perBranch);
+        dumpBranchStats(slots[0]);
+    }
+    dumpConfidence();
 
+    // 目标预测错误与上表的方向预测错误分开统计
+    string targetTable = targets->report(instructions);
+    cout << targetTable << endl;
+    OutFile << targetTable << endl;
 
+    OutFile.close();
+    // trace只含预热和测量阶段的分支, -ff跳过的指令和SimPoint区间之间的指令不计入
+    trace.close(phaseCtrl.instrumented());
+    unlockSlots();
+}
 
-// This function is called every time a control-flow instruction is encountered
-void predictBranch(ADDRINT pc, BOOL direction)
+// Write the predictors and the counters to a checkpoint
+void saveState(CkptWriter& w)
 {
-    BOOL prediction = BP->predict(pc);
-    BP->update(direction, prediction, pc);
-    if (prediction)
+    lockSlots();
+    w.put(measureStart);
+    w.put(accInstructions);
+    targets->save(w);
+    for (size_t i = 0; i < slots.size(); i++)
     {
-        if (direction)
-            takenCorrect++;
-        else
-            takenIncorrect++;
+        w.putArray(slots[i].counters, 4);
+        w.putArray(slots[i].acc, 4);
+        slots[i].bp->save(w);
     }
-    else
+
+    // 每个线程的预测器或历史, 恢复时在线程开始前按tid建好
+    w.put((UINT32)threadStates.size());
+    for (size_t t = 0; t < threadStates.size(); t++)
     {
-        if (direction)
-            notTakenIncorrect++;
-        else
-            notTakenCorrect++;
+        ThreadState* ts = threadStates[t];
+        PIN_GetLock(&ts->lock, PIN_ThreadId() + 1);
+        w.put(ts->tid);
+        for (size_t i = 0; i < ts->bps.size(); i++)
+        {
+            w.putArray(ts->counters[i].c, 4);
+            ts->bps[i]->save(w);
+        }
+        for (size_t i = 0; i < ts->hist.size(); i++)
+            if (ts->hist[i]) w.putArray(ts->hist[i], slots[i].bp->historySize());
+        PIN_ReleaseLock(&ts->lock);
     }
+    w.put(histOwner ? (INT32)histOwner->tid : -1);
+    unlockSlots();
 }
 
-// Pin calls this function every time a new instruction is encountered
-void Instruction(INS ins, void * v)
+// Read the state written by saveState, in the same order
+void loadState(CkptReader& r)
 {
-    if (INS_IsControlFlow(ins) && INS_HasFallThrough(ins))
+    r.get(measureStart);
+    r.get(accInstructions);
+    targets->load(r);
+    for (size_t i = 0; i < slots.size(); i++)
     {
-        // Insert a call to the branch target
-        INS_InsertCall(ins, IPOINT_TAKEN_BRANCH, (AFUNPTR)predictBranch,
-                        IARG_INST_PTR, IARG_BOOL, TRUE, IARG_END);
+        r.getArray(slots[i].counters, 4);
+        r.getArray(slots[i].acc, 4);
+        slots[i].bp->load(r);
+    }
 
-        // Insert a call to the next instruction of a branch
-        INS_InsertCall(ins, IPOINT_AFTER, (AFUNPTR)predictBranch,
-                        IARG_INST_PTR, IARG_BOOL, FALSE, IARG_END);
+    UINT32 threads = 0;
+    r.get(threads);
+    for (UINT32 t = 0; t < threads; t++)
+    {
+        THREADID tid = 0;
+        r.get(tid);
+        ThreadState* ts = newThreadState(tid);
+        for (size_t i = 0; i < ts->bps.size(); i++)
+        {
+            r.getArray(ts->counters[i].c, 4);
+            ts->bps[i]->load(r);
+        }
+        for (size_t i = 0; i < ts->hist.size(); i++)
+            if (ts->hist[i]) r.getArray(ts->hist[i], slots[i].bp->historySize());
     }
+    INT32 owner = -1;
+    r.get(owner);
+    for (size_t t = 0; t < threadStates.size(); t++)
+        if ((INT32)threadStates[t]->tid == owner) histOwner = threadStates[t];
 }
 
-// This knob sets the output file name
-KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o", "brchPredict.txt", "specify the output file name");
+// Ask the workers to exit, Pin waits for internal threads only after this callback
+VOID PrepareForFini(VOID* v)
+{
+    lockSlots();
+    stopping = true;
+    for (size_t i = 0; i < workers.size(); i++) PIN_SemaphoreSet(&workers[i]->go);
+    unlockSlots();
+}
 
 // This function is called when the application exits
 VOID Fini(int, VOID * v)
 {
-	double precision = 100 * double(takenCorrect + notTakenCorrect) / (takenCorrect + notTakenCorrect + takenIncorrect + notTakenIncorrect);
-    
-    cout << "takenCorrect: " << takenCorrect << endl
-    	<< "takenIncorrect: " << takenIncorrect << endl
-    	<< "notTakenCorrect: " << notTakenCorrect << endl
-    	<< "nnotTakenIncorrect: " << notTakenIncorrect << endl
-    	<< "Precision: " << precision << endl;
-    
-    OutFile.setf(ios::showbase);
-    OutFile << "takenCorrect: " << takenCorrect << endl
-    	<< "takenIncorrect: " << takenIncorrect << endl
-    	<< "notTakenCorrect: " << notTakenCorrect << endl
-    	<< "nnotTakenIncorrect: " << notTakenIncorrect << endl
-    	<< "Precision: " << precision << endl;
-    
-    OutFile.close();
-    delete BP;
+    if (!phaseCtrl.measuring() && !phaseCtrl.sampling())
+        cout << "Warning: the application exited before the measurement phase started" << endl;
+    phaseCtrl.atExit();
+    dumpResults();
+    for (size_t i = 0; i < workers.size(); i++) PIN_WaitForThreadTermination(workers[i]->uid, PIN_INFINITE_TIMEOUT, NULL);
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        delete slots[i].bp;
+        delete[] slots[i].preds;
+        delete slots[i].perBranch;
+        delete slots[i].conf;
+    }
+    for (size_t t = 0; t < threadStates.size(); t++) deleteThreadState(threadStates[t]);
+    delete[] batch;
+    delete targets;
 }
 
 /* ===================================================================== */
@@ -573,22 +919,102 @@ INT32 Usage()
 
 int main(int argc, char * argv[])
 {
-    // TODO: New your Predictor below.
-    // BP = new BHTPredictor(14);
-    // BP = new GlobalHistoryPredictor<f_xor,f_xnor>(22,11,9);
-    // BP = new TournamentPredictor(new GlobalHistoryPredictor<f_xor>(13,13),new GlobalHistoryPredictor<f_xnor>(13,13));
-    BP = new TAGEPredictor<f_xor, f_xnor>(8, 14, 2, 2, 11,12);
-    
     // Initialize pin
+    PIN_InitSymbols();
     if (PIN_Init(argc, argv)) return Usage();
     
     OutFile.open(KnobOutputFile.Value().c_str());
 
+    if (KnobThreadMode.Value() == "history") threadMode = TM_HISTORY;
+    else if (KnobThreadMode.Value() == "private") threadMode = TM_PRIVATE;
+    else if (KnobThreadMode.Value() != "shared")
+    {
+        cerr << "brchPredict: unknown -tmode " << KnobThreadMode.Value() << endl;
+        return 1;
+    }
+
+    // 目标预测器的大小和predictor spec一样在启动时检查, 0项或过大的表会在分配/取模时出错
+    if (KnobBtbSets.Value() > 24 || KnobBtbWays.Value() < 1 || KnobBtbWays.Value() > 64
+        || KnobRasDepth.Value() < 1 || KnobRasDepth.Value() > 65536 || KnobIttage.Value() > 24)
+    {
+        cerr << "brchPredict: -btb must be 0-24, -btbw 1-64, -ras 1-65536 and -ittage 0-24" << endl;
+        return 1;
+    }
+
+    // Build every predictor given by -bp, the joined specs also validate checkpoints
+    string bpConfig = KnobThreadMode.Value() + ";";
+    for (UINT32 i = 0; i < KnobPredictor.NumberOfValues(); i++)
+    {
+        PredictorSlot s;
+        s.spec = KnobPredictor.Value(i);
+        s.bp = newPredictor(s.spec);
+        if (s.bp == NULL) return 1;
+        memset(s.counters, 0, sizeof(s.counters));
+        memset(s.acc, 0, sizeof(s.acc));
+        s.preds = NULL;
+        s.perBranch = i == 0 && !KnobBranchStats.Value().empty() ? new BranchStatsTable() : NULL;
+        s.conf = KnobConfidence.Value() ? new ConfidenceStats() : NULL;
+        slots.push_back(s);
+        bpConfig += (i ? ";" : "") + s.spec;
+    }
+    reserveBatch(KnobBufferPages.Value() * 4096 / sizeof(BranchRecord));
+
+    targets = new TargetModel(KnobBtbSets.Value(), KnobBtbWays.Value(), KnobRasDepth.Value(), KnobIttage.Value());
+    char targetConfig[128];
+    snprintf(targetConfig, sizeof(targetConfig), ";btb=%u,%u;ras=%u;ittage=%u", KnobBtbSets.Value(),
+             KnobBtbWays.Value(), KnobRasDepth.Value(), KnobIttage.Value());
+    bpConfig += targetConfig;
+
+    // Branches are recorded into per-thread buffers and predicted in batches
+    PIN_InitLock(&bpLock);
+    brchBuf = PIN_DefineTraceBuffer(sizeof(BranchRecord), KnobBufferPages.Value(), consumeBranches, 0);
+    if (brchBuf == BUFFER_ID_INVALID)
+    {
+        cerr << "brchPredict: cannot allocate the branch buffer" << endl;
+        return 1;
+    }
+    if (!KnobTrace.Value().empty() && !trace.open(KnobTrace.Value().c_str()))
+    {
+        cerr << "brchPredict: cannot open the trace " << KnobTrace.Value() << endl;
+        return 1;
+    }
+
+    // Per-thread predictors or histories live in Pin TLS
+    tlsKey = PIN_CreateThreadDataKey(NULL);
+    PIN_AddThreadStartFunction(ThreadStart, 0);
+
+    // The predictors are spread across -workers internal threads; private threads predict on their own
+    for (UINT32 i = 0; i < KnobWorkers.Value() && i < slots.size() && threadMode != TM_PRIVATE; i++)
+    {
+        Worker* w = new Worker();
+        w->id = i;
+        PIN_SemaphoreInit(&w->go);
+        PIN_SemaphoreInit(&w->done);
+        PIN_SemaphoreSet(&w->done);
+        workers.push_back(w);
+    }
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        if (PIN_SpawnInternalThread(workerMain, workers[i], 0, &workers[i]->uid) == INVALID_THREADID)
+        {
+            cerr << "brchPredict: cannot start worker thread " << i << endl;
+            return 1;
+        }
+    }
+
     // Register Instruction to be called to instrument instructions
     INS_AddInstrumentFunction(Instruction, 0);
 
     // Register Fini to be called when the application exits
     PIN_AddFiniFunction(Fini, 0);
+    PIN_AddPrepareForFiniFunction(PrepareForFini, 0);
+
+    // Restore a checkpoint and/or arrange for checkpoints to be written
+    if (!checkpointer.init("brchPredict", bpConfig, saveState, loadState)) return 1;
+
+    // Results are dumped at detach if a measurement window is given
+    phaseCtrl.trackPosition();          // MPKI需要测量区间的指令数
+    phaseCtrl.init(beginMeasure, endRegion, dumpResults);
 
     // Start the program, never returns
     PIN_StartProgram();
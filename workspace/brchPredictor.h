@@ -0,0 +1,2066 @@
+/**************************************
+ * Branch predictors of brchPredict
+ * 也被离线回放程序brchReplay使用, 此时定义BRCH_STANDALONE, 不依赖Pin
+**************************************/
+#ifndef BRCH_PREDICTOR_H
+#define BRCH_PREDICTOR_H
+
+#include <cassert>
+#include <cctype>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef BRCH_STANDALONE
+#include <stdint.h>
+typedef uint8_t             UINT8;
+typedef uint16_t            UINT16;
+typedef uint32_t            UINT32;
+typedef unsigned long int   UINT64;
+typedef int8_t              INT8;
+typedef int32_t             INT32;
+typedef int64_t             INT64;
+typedef UINT64              ADDRINT;
+typedef bool                BOOL;
+#else
+#include "pin.H"
+#endif
+#include "ckptStream.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+typedef unsigned __int128   UINT128;
+
+// 将val截断, 使其宽度变成bits
+#define truncate(val, bits) (((UINT128)val) & (((UINT128)1 << ((UINT128)bits)) - (UINT128)1))
+
+// 饱和计数器 (N < 64)
+class SaturatingCnt
+{
+    size_t m_wid;
+    UINT8 m_val;
+    const UINT8 m_init_val;
+
+    public:
+        SaturatingCnt(size_t width = 2) : m_init_val((1 << width) / 2)
+        {
+            m_wid = width;
+            m_val = m_init_val;
+        }
+
+        void increase() { if (m_val < (1 << m_wid) - 1) m_val++; }
+        void decrease() { if (m_val > 0) m_val--; }
+
+        void reset() { m_val = m_init_val; }
+        UINT8 getVal() { return m_val; }
+        void setVal(UINT8 val) { m_val = val; }
+
+        bool isTaken() { return (m_val > (1 << m_wid)/2 - 1); }
+};
+
+// 饱和计数器数组: 每个计数器占2的幂位 (3位计数器占4位), 打包在64位字中
+// 与SaturatingCnt行为相同, 2位计数器每个只占1/4字节
+class PackedCounters
+{
+    size_t m_num;
+    UINT32 m_wid;
+    UINT32 m_shift;         // log2(每个计数器占的位数)
+    UINT32 m_max;
+    UINT64* m_words;
+
+    size_t words() { return ((m_num << m_shift) + 63) >> 6; }
+    UINT64& word(size_t i) { return m_words[i >> (6 - m_shift)]; }
+    UINT32 pos(size_t i) { return (UINT32)(i & ((64 >> m_shift) - 1)) << m_shift; }
+
+    public:
+        // param:   num:    计数器个数
+        //          width:  每个计数器的位数 (<= 8)
+        PackedCounters(size_t num, size_t width = 2) : m_num(num), m_wid(width), m_shift(0), m_max((1u << width) - 1)
+        {
+            while ((1u << m_shift) < width) m_shift++;
+            m_words = new UINT64[words()];
+            fill((1u << width) / 2);        // 与SaturatingCnt相同, 初始为弱taken
+        }
+
+        ~PackedCounters() { delete[] m_words; }
+
+        UINT32 get(size_t i) { return (word(i) >> pos(i)) & m_max; }
+        bool isTaken(size_t i) { return get(i) > m_max / 2; }
+        UINT32 max() { return m_max; }
+
+        void set(size_t i, UINT32 val)
+        {
+            UINT64& w = word(i);
+            w = (w & ~((UINT64)m_max << pos(i))) | ((UINT64)val << pos(i));
+        }
+
+        // taken时加1, 否则减1, 饱和, 无分支
+        void update(size_t i, bool taken)
+        {
+            UINT64& w = word(i);
+            UINT32 p = pos(i);
+            UINT32 c = (w >> p) & m_max;
+            c = c + (taken & (c != m_max)) - (!taken & (c != 0));
+            w = (w & ~((UINT64)m_max << p)) | ((UINT64)c << p);
+        }
+
+        void fill(UINT32 val)
+        {
+            UINT64 pattern = 0;
+            for (UINT32 p = 0; p < 64; p += 1u << m_shift) pattern |= (UINT64)val << p;
+            for (size_t j = 0; j < words(); j++) m_words[j] = pattern;
+        }
+
+        size_t bytes() { return words() * sizeof(UINT64); }
+        UINT64 bits() { return (UINT64)m_num * m_wid; }      // 建模的存储量, 不含对齐的空位
+
+        void save(CkptWriter& w) { w.putArray(m_words, words()); }
+        void load(CkptReader& r) { r.getArray(m_words, words()); }
+};
+
+// a[j] &= mask for a whole table, used to age packed usefulness bits
+static inline void andWords(UINT32* a, size_t n, UINT32 mask)
+{
+    size_t j = 0;
+#if defined(__AVX2__)
+    __m256i m = _mm256_set1_epi32((int)mask);
+    for (; j + 8 <= n; j += 8)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(a + j));
+        _mm256_storeu_si256((__m256i*)(a + j), _mm256_and_si256(v, m));
+    }
+#elif defined(__SSE2__)
+    __m128i m = _mm_set1_epi32((int)mask);
+    for (; j + 4 <= n; j += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(a + j));
+        _mm_storeu_si128((__m128i*)(a + j), _mm_and_si128(v, m));
+    }
+#endif
+    for (; j < n; j++) a[j] &= mask;
+}
+
+// 移位寄存器: 循环位缓冲区, 宽度不受限
+class ShiftReg
+{
+    size_t m_wid;
+    size_t m_mask;          // 缓冲区大小 - 1, 大小为2的幂且大于m_wid
+    size_t m_head;          // 最新一位的位置
+    bool* m_bits;
+
+    public:
+        ShiftReg(size_t width) : m_wid(width), m_head(0)
+        {
+            size_t size = 1;
+            while (size <= width) size <<= 1;
+            m_mask = size - 1;
+            m_bits = new bool[size];
+            memset(m_bits, 0, sizeof(bool) * size);
+        }
+
+        ~ShiftReg() { delete[] m_bits; }
+
+        // 移入b, 返回移出窗口的一位
+        bool shiftIn(bool b)
+        {
+            m_head = (m_head - 1) & m_mask;
+            m_bits[m_head] = b;
+            return m_bits[(m_head + m_wid) & m_mask];
+        }
+
+        // 第i位, 0为最新
+        bool bit(size_t i) { return m_bits[(m_head + i) & m_mask]; }
+        size_t width() { return m_wid; }
+
+        // 按字节拷贝出/入整个寄存器, 返回缓冲区中的下一个位置
+        size_t bytes() { return sizeof(m_head) + m_mask + 1; }
+
+        UINT8* copyTo(UINT8* p)
+        {
+            memcpy(p, &m_head, sizeof(m_head));
+            memcpy(p + sizeof(m_head), m_bits, m_mask + 1);
+            return p + bytes();
+        }
+
+        const UINT8* copyFrom(const UINT8* p)
+        {
+            memcpy(&m_head, p, sizeof(m_head));
+            memcpy(m_bits, p + sizeof(m_head), m_mask + 1);
+            return p + bytes();
+        }
+
+        void save(CkptWriter& w)
+        {
+            w.put(m_head);
+            w.putBits(m_bits, m_mask + 1);
+        }
+
+        void load(CkptReader& r)
+        {
+            r.get(m_head);
+            r.getBits(m_bits, m_mask + 1);
+        }
+};
+
+// 折叠历史寄存器: 把olen位的历史异或折叠成clen位 (clen < 32), 每次移位O(1)更新
+class FoldedHistory
+{
+    UINT32 m_val;
+    size_t m_olen;
+    size_t m_clen;
+    size_t m_outpoint;      // 移出窗口的一位在折叠结果中的位置
+
+    public:
+        FoldedHistory() : m_val(0), m_olen(0), m_clen(1), m_outpoint(0) {}
+
+        void init(size_t olen, size_t clen)
+        {
+            m_val = 0;
+            m_olen = olen;
+            m_clen = clen;
+            m_outpoint = olen % clen;
+        }
+
+        // param:   in:     移入的一位
+        //          out:    同时移出olen位窗口的一位
+        void update(bool in, bool out)
+        {
+            m_val = (m_val << 1) | in;
+            m_val ^= (UINT32)out << m_outpoint;
+            m_val ^= m_val >> m_clen;
+            m_val &= (1u << m_clen) - 1;
+        }
+
+        UINT32 getVal() { return m_val; }
+        void setVal(UINT32 val) { m_val = val; }
+};
+
+// Copy n folded registers out of/into a history buffer, return the next position
+static inline UINT8* copyFolds(UINT8* p, FoldedHistory* f, size_t n)
+{
+    for (size_t i = 0; i < n; i++, p += sizeof(UINT32))
+    {
+        UINT32 v = f[i].getVal();
+        memcpy(p, &v, sizeof(v));
+    }
+    return p;
+}
+
+static inline const UINT8* copyFolds(const UINT8* p, FoldedHistory* f, size_t n)
+{
+    for (size_t i = 0; i < n; i++, p += sizeof(UINT32))
+    {
+        UINT32 v = 0;
+        memcpy(&v, p, sizeof(v));
+        f[i].setVal(v);
+    }
+    return p;
+}
+
+// Hash functions of (pc, folded history), the predictors keep the low bits of the result.
+// 作为模板参数在编译期实例化, newPredictor按spec中的hash/taghash选择, 哈希路径上没有虚函数调用
+typedef UINT128 (*HashFn)(UINT128 pc, UINT128 ghr);
+
+inline UINT128 f_xor(UINT128 a, UINT128 b) { return a ^ b; }
+// inline UINT128 f_xor1(UINT128 a, UINT128 b) { return a & b; }
+inline UINT128 f_xnor(UINT128 a, UINT128 b) { return ~(a ^ b); }
+
+// CRC-32C of the 64-bit a ^ (b << 7), bytewise with a 256-entry table
+struct Crc32Table
+{
+    UINT32 t[256];
+    Crc32Table()
+    {
+        for (UINT32 i = 0; i < 256; i++)
+        {
+            UINT32 c = i;
+            for (int k = 0; k < 8; k++) c = (c >> 1) ^ (0x82f63b78 & (0 - (c & 1)));
+            t[i] = c;
+        }
+    }
+};
+
+inline UINT128 f_crc(UINT128 a, UINT128 b)
+{
+    static const Crc32Table table;
+    UINT64 v = (UINT64)a ^ ((UINT64)b << 7);
+    UINT32 c = ~0u;
+    for (int k = 0; k < 8; k++, v >>= 8) c = table.t[(c ^ v) & 0xff] ^ (c >> 8);
+    return ~c;
+}
+
+// Multiply-shift: the odd golden-ratio multiplier spreads every input bit into the high half
+inline UINT128 f_mul(UINT128 a, UINT128 b)
+{
+    return (((UINT64)a ^ ((UINT64)b << 16) ^ (UINT64)b) * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+// Seznec的skewing函数: H(x)为32位上的一次移位加反馈, a用H, b用H的逆, 不同表的冲突集合不同
+inline UINT32 skewH(UINT32 x) { return (x >> 1) | (((x ^ (x >> 31)) & 1) << 31); }
+inline UINT32 skewHinv(UINT32 x) { return (x << 1) | (((x >> 31) ^ (x >> 30)) & 1); }
+inline UINT128 f_skew(UINT128 a, UINT128 b) { return skewH((UINT32)a ^ (UINT32)(a >> 32)) ^ skewHinv((UINT32)b) ^ (UINT32)b; }
+
+static const size_t NHASH = 5;
+static const char* const HASH_NAMES[NHASH] = { "xor", "xnor", "crc", "mul", "skew" };
+static const HashFn HASH_FNS[NHASH] = { f_xor, f_xnor, f_crc, f_mul, f_skew };
+
+// Index of a hash function in HASH_NAMES, -1 if unknown
+inline int hashIndex(const std::string& name)
+{
+    for (size_t i = 0; i < NHASH; i++)
+        if (name == HASH_NAMES[i]) return (int)i;
+    return -1;
+}
+
+
+/* ===================================================================== */
+/* Buffered branch records                                               */
+/* ===================================================================== */
+// 分支类型
+enum BranchType
+{
+    BR_COND = 0,        // 条件直接跳转
+    BR_JUMP,            // 无条件直接跳转
+    BR_INDIRECT,        // 间接跳转
+    BR_CALL,            // 直接调用
+    BR_ICALL,           // 间接调用
+    BR_RET,
+    BR_NTYPES
+};
+
+// One dynamic branch, written by the instrumentation into Pin's per-thread trace buffer
+struct BranchRecord
+{
+    ADDRINT pc;
+    ADDRINT target;
+    UINT32 type;        // BranchType
+    UINT32 size;        // 指令长度, pc + size为返回地址
+    BOOL taken;
+};
+
+// Base class of all predictors
+class BranchPredictor
+{
+    public:
+        BranchPredictor() {}
+        virtual ~BranchPredictor() {}
+        virtual bool predict(ADDRINT addr) { return false; };
+        virtual void update(bool takenActually, bool takenPredicted, ADDRINT addr) {};
+
+        // Predict and update a batch of buffered conditional branches in program order, preds[i] gets the prediction of recs[i]
+        virtual void runBatch(const BranchRecord* recs, UINT64 n, bool* preds)
+        {
+            for (UINT64 i = 0; i < n; i++)
+            {
+                preds[i] = predict(recs[i].pc);
+                update(recs[i].taken, preds[i], recs[i].pc);
+            }
+        }
+
+        // Index of the sub-predictor or table that provided the last prediction, 0 if there is only one
+        virtual int provider() { return 0; }
+
+        // Built-in confidence of the last prediction, e.g. a saturated provider counter of TAGE;
+        // predictors without one return false from hasConfidence() and are only rated by JRSConfidence
+        virtual bool hasConfidence() { return false; }
+        virtual bool highConfidence() { return false; }
+
+        // Split update for DelayedUpdatePredictor: after predict() the in-flight state (indices, tags,
+        // provider) is copied out with saveInflight(), the history is updated right away with
+        // updateHistory() and the tables later from the saved state with updateTables().
+        // inflightSize() is the size of the state in bytes, 0 if the predictor does not support it
+        virtual size_t inflightSize() { return 0; }
+        virtual void saveInflight(void* st, ADDRINT addr) {}
+        virtual void updateHistory(bool takenActually, ADDRINT addr) {}
+        virtual void updateTables(const void* st, bool takenActually, bool takenPredicted, ADDRINT addr) {}
+
+        // Shared-tables/private-history mode: the global history, but not the tables, is copied out of/into
+        // a buffer of historySize() bytes so that every thread keeps its own; all zeros is an empty history
+        virtual size_t historySize() { return 0; }
+        virtual void getHistory(UINT8* buf) {}
+        virtual void setHistory(const UINT8* buf) {}
+
+        // Modeled hardware storage in bits: tables at their architectural widths plus history registers
+        virtual UINT64 storageBits() { return 0; }
+
+        // Component statistics beyond the four counters, e.g. how often a sub-predictor overrode another
+        virtual void resetStats() {}
+        virtual std::string report() { return ""; }
+
+        // Write/read tables, histories and counters to/from a checkpoint
+        virtual void save(CkptWriter& w) {}
+        virtual void load(CkptReader& r) {}
+};
+
+
+/* ===================================================================== */
+/* Confidence estimation                                                 */
+/* ===================================================================== */
+// JRS (Jacobsen, Rotenberg, Smith) 置信度估计: 以PC和全局历史索引的重置计数器,
+// 预测正确时加1, 错误时清0, 达到阈值为高置信度. 与预测器无关, 可以给任何预测器评级
+class JRSConfidence
+{
+    const size_t m_entries_log;
+    const UINT32 m_threshold;
+    PackedCounters m_ctr;
+    UINT32 m_ghr;                       // 自己的全局历史, m_entries_log位
+    UINT32 m_idx;                       // highConfidence时计算, update时复用
+
+    public:
+        // param:   entry_num_log:  计数器个数的对数
+        //          width:          计数器位数
+        //          threshold:      不小于此值为高置信度, 默认为计数器最大值
+        JRSConfidence(size_t entry_num_log = 12, size_t width = 4, UINT32 threshold = 15)
+        : m_entries_log(entry_num_log), m_threshold(threshold), m_ctr((size_t)1 << entry_num_log, width), m_ghr(0), m_idx(0)
+        {
+            m_ctr.fill(0);
+        }
+
+        bool highConfidence(ADDRINT addr)
+        {
+            m_idx = truncate(addr ^ (addr >> m_entries_log) ^ m_ghr, m_entries_log);
+            return m_ctr.get(m_idx) >= m_threshold;
+        }
+
+        void update(bool correct, bool taken)
+        {
+            if (correct) m_ctr.update(m_idx, true);
+            else m_ctr.set(m_idx, 0);
+            m_ghr = truncate((m_ghr << 1) | (taken ? 1 : 0), m_entries_log);
+        }
+};
+
+/* ===================================================================== */
+/* BHT-based branch predictor                                            */
+/* ===================================================================== */
+class BHTPredictor: public BranchPredictor
+{
+    size_t m_entries_log;
+    PackedCounters m_scnt;              // BHT
+    
+    public:
+        // Constructor
+        // param:   entry_num_log:  BHT行数的对数
+        //          scnt_width:     饱和计数器的位数, 默认值为2
+        BHTPredictor(size_t entry_num_log, size_t scnt_width = 2)
+        : m_entries_log(entry_num_log), m_scnt((size_t)1 << entry_num_log, scnt_width)
+        {}
+
+        BOOL predict(ADDRINT addr)
+        {
+            //get hash
+            int tag = truncate(addr, m_entries_log);
+
+            return m_scnt.isTaken(tag);
+        }
+
+        void update(BOOL takenActually, BOOL takenPredicted, ADDRINT addr)
+        {
+            // TODO: Update BHT according to branch results and prediction
+
+            //get hash
+            int tag = truncate(addr, m_entries_log);
+
+            m_scnt.update(tag, takenActually);
+        }
+
+        // 没有历史, 只推迟计数器的更新
+        size_t inflightSize() { return sizeof(UINT32); }
+        void saveInflight(void* st, ADDRINT addr) { *(UINT32*)st = truncate(addr, m_entries_log); }
+        void updateTables(const void* st, bool takenActually, bool takenPredicted, ADDRINT addr)
+        {
+            m_scnt.update(*(const UINT32*)st, takenActually);
+        }
+
+        UINT64 storageBits() { return m_scnt.bits(); }
+
+        void save(CkptWriter& w) { m_scnt.save(w); }
+        void load(CkptReader& r) { m_scnt.load(r); }
+};
+
+/* ===================================================================== */
+/* Global-history-based branch predictor                                 */
+/* ===================================================================== */
+// PHT没有tag, 只有索引哈希一个参数
+template<UINT128 (*hash1)(UINT128 pc, UINT128 ghr)>
+class GlobalHistoryPredictor: public BranchPredictor
+{
+    ShiftReg* m_ghr;                   // GHR
+    size_t m_ghr_size;
+    FoldedHistory m_idx_fold;           // GHR折叠成m_entries_log位, 用于索引
+    size_t m_entries_log;                   // PHT行数的对数
+    PackedCounters m_scnt;              // PHT中的分支历史字段
+    
+    public:
+        // Constructor
+        // param:   ghr_width:      Width of GHR
+        //          entry_num_log:  PHT表行数的对数
+        //          scnt_width:     饱和计数器的位数, 默认值为2
+        GlobalHistoryPredictor(size_t ghr_width, size_t entry_num_log, size_t scnt_width = 2)
+        : m_entries_log(entry_num_log), m_scnt((size_t)1 << entry_num_log, scnt_width)
+        {
+            m_ghr = new ShiftReg(ghr_width);
+            m_ghr_size = ghr_width;
+            m_idx_fold.init(ghr_width, entry_num_log);
+        }
+
+        // Destructor
+        ~GlobalHistoryPredictor()
+        {
+            delete m_ghr;
+        }
+
+        size_t get_ghr_size()
+        {
+            return m_ghr_size;
+        }
+
+        void shift_ghr(bool taken)
+        {
+            bool out = m_ghr->shiftIn(taken);
+            m_idx_fold.update(taken, out);
+        }
+
+        bool predict(ADDRINT addr)
+        {
+            return m_scnt.isTaken(getIdx(addr));
+        }
+
+        void update(bool takenActually, bool takenPredicted, ADDRINT addr)
+        {
+            //update BHT
+            // int tag = truncate(hash(addr, m_ghr->getVal()),m_entries_log);
+            int idx = getIdx(addr);
+            
+            m_scnt.update(idx, takenActually);
+
+            //update ghr
+            shift_ghr(takenActually);
+
+            // printf("%d\n",(int)(m_ghr->getVal()));
+        }
+
+        UINT64 storageBits() { return m_scnt.bits() + m_ghr_size; }
+
+        size_t historySize() { return m_ghr->bytes() + sizeof(UINT32); }
+        void getHistory(UINT8* buf) { copyFolds(m_ghr->copyTo(buf), &m_idx_fold, 1); }
+        void setHistory(const UINT8* buf) { copyFolds(m_ghr->copyFrom(buf), &m_idx_fold, 1); }
+
+        size_t inflightSize() { return sizeof(UINT32); }
+        void saveInflight(void* st, ADDRINT addr) { *(UINT32*)st = getIdx(addr); }
+        void updateHistory(bool takenActually, ADDRINT addr) { shift_ghr(takenActually); }
+        void updateTables(const void* st, bool takenActually, bool takenPredicted, ADDRINT addr)
+        {
+            m_scnt.update(*(const UINT32*)st, takenActually);
+        }
+    
+        int getIdx(ADDRINT addr)
+        {
+            // return truncate(hash(addr,m_ghr->getVal()),m_entries_log);
+            return truncate(hash1(addr ^ (addr >> m_entries_log), m_idx_fold.getVal()), m_entries_log);
+        }
+
+        void save(CkptWriter& w)
+        {
+            m_ghr->save(w);
+            w.put(m_idx_fold.getVal());
+            m_scnt.save(w);
+        }
+
+        void load(CkptReader& r)
+        {
+            UINT32 fold = 0;
+            m_ghr->load(r);
+            r.get(fold);
+            m_idx_fold.setVal(fold);
+            m_scnt.load(r);
+        }
+};
+
+/* ===================================================================== */
+/* Local-history two-level predictor (PAg / PAp / SAg ...)              */
+/* ===================================================================== */
+// 第一级: 以PC索引的局部历史表 (BHT行多为P, 行少为S)
+// 第二级: 以 (PC所在的组, 局部历史) 索引的PHT, 组数为1时即为g
+class LocalHistoryPredictor: public BranchPredictor
+{
+    size_t m_bht_log;                   // 局部历史表行数的对数
+    size_t m_hist_len;                  // 局部历史的位数 (<= 16)
+    size_t m_pht_log;                   // PHT组数的对数
+    UINT16* m_hist;                     // 局部历史, 最低位为最新
+    PackedCounters m_ctr;               // PHT
+
+    size_t m_hidx;                      // predict时计算, update时复用
+    size_t m_pidx;
+
+    public:
+        // param:   bht_log:    局部历史表行数的对数
+        //          hist_len:   局部历史的位数, 不超过16
+        //          pht_log:    PHT组数的对数, 0为所有分支共享一个PHT
+        //          scnt_width: 饱和计数器的位数
+        LocalHistoryPredictor(size_t bht_log, size_t hist_len, size_t pht_log = 0, size_t scnt_width = 3)
+        : m_bht_log(bht_log), m_hist_len(hist_len > 16 ? 16 : hist_len), m_pht_log(pht_log),
+          m_ctr((size_t)1 << (pht_log + m_hist_len), scnt_width), m_hidx(0), m_pidx(0)
+        {
+            m_hist = new UINT16[1 << m_bht_log];
+            memset(m_hist, 0, sizeof(UINT16) << m_bht_log);
+        }
+
+        ~LocalHistoryPredictor()
+        {
+            delete[] m_hist;
+        }
+
+        BOOL predict(ADDRINT addr)
+        {
+            m_hidx = truncate(addr, m_bht_log);
+            m_pidx = (truncate(addr, m_pht_log) << m_hist_len) | m_hist[m_hidx];
+            return m_ctr.isTaken(m_pidx);
+        }
+
+        void update(BOOL takenActually, BOOL takenPredicted, ADDRINT addr)
+        {
+            m_ctr.update(m_pidx, takenActually);
+            m_hist[m_hidx] = truncate((m_hist[m_hidx] << 1) | (takenActually ? 1 : 0), m_hist_len);
+        }
+
+        UINT64 storageBits() { return ((UINT64)m_hist_len << m_bht_log) + m_ctr.bits(); }
+
+        size_t inflightSize() { return sizeof(UINT32); }
+        void saveInflight(void* st, ADDRINT addr) { *(UINT32*)st = m_pidx; }
+        void updateHistory(bool takenActually, ADDRINT addr)
+        {
+            UINT16& h = m_hist[truncate(addr, m_bht_log)];
+            h = truncate((h << 1) | (takenActually ? 1 : 0), m_hist_len);
+        }
+        void updateTables(const void* st, bool takenActually, bool takenPredicted, ADDRINT addr)
+        {
+            m_ctr.update(*(const UINT32*)st, takenActually);
+        }
+
+        // 不经过虚函数调用
+        void runBatch(const BranchRecord* recs, UINT64 n, bool* preds)
+        {
+            for (UINT64 i = 0; i < n; i++)
+            {
+                preds[i] = LocalHistoryPredictor::predict(recs[i].pc);
+                LocalHistoryPredictor::update(recs[i].taken, preds[i], recs[i].pc);
+            }
+        }
+
+        void save(CkptWriter& w)
+        {
+            w.putArray(m_hist, (size_t)1 << m_bht_log);
+            m_ctr.save(w);
+        }
+
+        void load(CkptReader& r)
+        {
+            r.getArray(m_hist, (size_t)1 << m_bht_log);
+            m_ctr.load(r);
+        }
+};
+
+/* ===================================================================== */
+/* Tournament predictor: Select output by global/local selection history */
+/* ===================================================================== */
+class TournamentPredictor: public BranchPredictor
+{
+    BranchPredictor* m_BPs[2];      // Sub-predictors
+    SaturatingCnt* m_gshr;          // Global select-history register
+    size_t m_gshr_width;
+
+    public:
+        TournamentPredictor(BranchPredictor* BP0, BranchPredictor* BP1, size_t gshr_width = 2)
+        {
+            m_BPs[0] = BP0;
+            m_BPs[1] = BP1;
+            m_gshr = new SaturatingCnt(gshr_width);
+            m_gshr_width = gshr_width;
+        }
+
+        ~TournamentPredictor()
+        {
+            delete m_BPs[0];
+            delete m_BPs[1];
+            delete m_gshr;
+        }
+
+        bool predict(ADDRINT addr)
+        {
+            if (m_gshr->isTaken()) {
+                return m_BPs[1]->predict(addr);
+            } else {
+                return m_BPs[0]->predict(addr);
+            }
+        };
+
+        // 0: BP0, 1: BP1
+        int provider() { return m_gshr->isTaken() ? 1 : 0; }
+
+        UINT64 storageBits() { return m_BPs[0]->storageBits() + m_BPs[1]->storageBits() + m_gshr_width; }
+
+        void update(bool takenActually, bool takenPredicted, ADDRINT addr)
+        {
+            //update gshr
+            if (m_BPs[1]->predict(addr) == takenActually && m_BPs[0]->predict(addr) != takenActually) {
+                m_gshr->increase();
+            } else if (m_BPs[1]->predict(addr) != takenActually && m_BPs[0]->predict(addr) == takenActually) {
+                m_gshr->decrease();
+            }
+
+            //update sub BP
+            m_BPs[0]->update(takenActually, takenPredicted, addr);
+            m_BPs[1]->update(takenActually, takenPredicted, addr);
+        };
+
+        size_t historySize() { return m_BPs[0]->historySize() + m_BPs[1]->historySize(); }
+
+        void getHistory(UINT8* buf)
+        {
+            m_BPs[0]->getHistory(buf);
+            m_BPs[1]->getHistory(buf + m_BPs[0]->historySize());
+        }
+
+        void setHistory(const UINT8* buf)
+        {
+            m_BPs[0]->setHistory(buf);
+            m_BPs[1]->setHistory(buf + m_BPs[0]->historySize());
+        }
+
+        void save(CkptWriter& w)
+        {
+            w.put(m_gshr->getVal());
+            m_BPs[0]->save(w);
+            m_BPs[1]->save(w);
+        }
+
+        void load(CkptReader& r)
+        {
+            UINT8 val = 0;
+            r.get(val);
+            m_gshr->setVal(val);
+            m_BPs[0]->load(r);
+            m_BPs[1]->load(r);
+        }
+};
+
+/* ===================================================================== */
+/* TArget GEometric history length Predictor                             */
+/* ===================================================================== */
+// 各带tag子预测器的表项打包在一个UINT32中: [tag | 饱和计数器 | usefulness(2位)],
+// 所有表连续存放, 共享一条全局历史, 每张表维护自己的折叠历史
+template<UINT128 (*hash1)(UINT128 pc, UINT128 ghr), UINT128 (*hash2)(UINT128 pc, UINT128 ghr)>
+class TAGEPredictor: public BranchPredictor
+{
+    static const UINT32 U_BITS = 2;
+
+    const size_t m_tnum;            // 子预测器个数 (T[0 : m_tnum - 1])
+    const size_t m_entries_log;     // 子预测器T[1 : m_tnum - 1]的PHT行数的对数
+    const size_t m_base_log;        // 子预测器T0的BHT行数的对数
+    const size_t m_tag_size;
+    const size_t m_ctr_width;
+    const UINT32 m_ctr_max;
+    const UINT32 m_ctr_init;        // 分配表项时的计数器初值 (弱taken)
+
+    PackedCounters m_base;          // T0: 2位饱和计数器
+    UINT32* m_entries;              // T[1 : m_tnum - 1]的表项, T[i]从(i - 1) << m_entries_log开始
+    size_t* m_hist_len;             // 各子预测器的历史长度
+    ShiftReg* m_ghr;                // 共享的全局历史, 宽度为最长的历史长度
+    FoldedHistory* m_idx_fold;
+    FoldedHistory* m_tag_fold[2];
+
+    // predict时计算, update时复用
+    UINT32* m_idx;                  // 各表的表项在m_entries中的位置
+    UINT32* m_tag;
+    UINT32 m_base_idx;
+    size_t provider_indx;           // Provider's index of T
+    size_t altpred_indx;            // Alternate provider's index of T
+    bool m_provider_pred;
+    bool m_alt_pred;
+
+    bool clear_high;
+    const size_t m_rst_period;      // Reset period of usefulness
+    size_t m_rst_cnt;               // Reset counter
+
+    UINT32 getU(UINT32 e) { return e & ((1u << U_BITS) - 1); }
+    UINT32 getCtr(UINT32 e) { return (e >> U_BITS) & m_ctr_max; }
+    UINT32 getTag(UINT32 e) { return e >> (U_BITS + m_ctr_width); }
+    UINT32 pack(UINT32 tag, UINT32 ctr, UINT32 u) { return (tag << (U_BITS + m_ctr_width)) | (ctr << U_BITS) | u; }
+    void setU(UINT32& e, UINT32 u) { e = (e & ~((1u << U_BITS) - 1)) | u; }
+    void setCtr(UINT32& e, UINT32 ctr) { e = (e & ~(m_ctr_max << U_BITS)) | (ctr << U_BITS); }
+
+    bool entryPred(size_t i)
+    {
+        if (i == 0) return m_base.isTaken(m_base_idx);
+        return getCtr(m_entries[m_idx[i]]) > m_ctr_max / 2;
+    }
+
+    public:
+        // Constructor
+        // param:   tnum:               The number of sub-predictors
+        //          T0_entry_num_log:   子预测器T0的BHT行数的对数
+        //          T1ghr_len:          子预测器T1的GHR位宽
+        //          alpha:              各子预测器T[1 : m_tnum - 1]的GHR几何倍数关系
+        //          Tn_entry_num_log:   各子预测器T[1 : m_tnum - 1]的PHT行数的对数
+        //          tag_size:           Width of tags (tag_size + scnt_width <= 30)
+        //          scnt_width:         Width of saturating counter (3 by default)
+        //          rst_period:         Reset period of usefulness
+        TAGEPredictor(size_t tnum, size_t T0_entry_num_log, size_t T1ghr_len, float alpha, size_t Tn_entry_num_log, size_t tag_size,size_t scnt_width = 3, size_t rst_period = 256*1024)
+        : m_tnum(tnum), m_entries_log(Tn_entry_num_log), m_base_log(T0_entry_num_log), m_tag_size(tag_size),
+          m_ctr_width(scnt_width), m_ctr_max((1u << scnt_width) - 1), m_ctr_init(1u << (scnt_width - 1)),
+          m_base((size_t)1 << T0_entry_num_log, 2),
+          m_base_idx(0), provider_indx(0), altpred_indx(0), m_provider_pred(false), m_alt_pred(false),
+          clear_high(true), m_rst_period(rst_period), m_rst_cnt(0)
+        {
+            assert(tag_size + scnt_width + U_BITS <= 32);
+
+            m_entries = new UINT32[(m_tnum - 1) << m_entries_log];
+            for (size_t j = 0; j < ((m_tnum - 1) << m_entries_log); j++) m_entries[j] = pack(0, m_ctr_init, 0);
+
+            m_hist_len = new size_t[m_tnum];
+            m_idx_fold = new FoldedHistory[m_tnum];
+            m_tag_fold[0] = new FoldedHistory[m_tnum];
+            m_tag_fold[1] = new FoldedHistory[m_tnum];
+            m_idx = new UINT32[m_tnum];
+            m_tag = new UINT32[m_tnum];
+
+            size_t ghr_size = T1ghr_len;
+            m_hist_len[0] = 0;
+            for (size_t i = 1; i < m_tnum; i++)
+            {
+                m_hist_len[i] = ghr_size;
+                m_idx_fold[i].init(ghr_size, m_entries_log);
+                m_tag_fold[0][i].init(ghr_size, m_tag_size);
+                m_tag_fold[1][i].init(ghr_size, m_tag_size - 1);
+                ghr_size = (size_t)(ghr_size * alpha);
+            }
+            m_ghr = new ShiftReg(m_hist_len[m_tnum - 1]);
+        }
+
+        ~TAGEPredictor()
+        {
+            delete[] m_entries;
+            delete[] m_hist_len;
+            delete[] m_idx_fold;
+            delete[] m_tag_fold[0];
+            delete[] m_tag_fold[1];
+            delete[] m_idx;
+            delete[] m_tag;
+            delete m_ghr;
+        }
+
+        bool predict(ADDRINT addr)
+        {
+            m_base_idx = truncate(addr, m_base_log);
+
+            // 一次算出所有表的索引和tag
+            for (size_t i = 1; i < m_tnum; i++)
+            {
+                m_idx[i] = ((i - 1) << m_entries_log)
+                         + (UINT32)truncate(hash1(addr ^ (addr >> m_entries_log), m_idx_fold[i].getVal()), m_entries_log);
+                m_tag[i] = truncate(hash2(addr, m_tag_fold[0][i].getVal() ^ (m_tag_fold[1][i].getVal() << 1)), m_tag_size);
+            }
+
+            provider_indx = 0;
+            altpred_indx = 0;
+
+            // from longest to shortest
+            for (size_t i = m_tnum - 1; i > 0; i--) {
+                if (getTag(m_entries[m_idx[i]]) == m_tag[i]) {
+                    if (provider_indx == 0) provider_indx = i;
+                    else {
+                        altpred_indx = i;
+                        break;
+                    }
+                }
+            }
+            m_provider_pred = entryPred(provider_indx);
+            m_alt_pred = entryPred(altpred_indx);
+
+            return m_provider_pred;
+        }
+
+        void update(bool takenActually, bool takenPredicted, ADDRINT addr)
+        {
+            updateEntries(takenActually, takenPredicted);
+            TAGEPredictor::updateHistory(takenActually, addr);
+        }
+
+        // 预测时的状态: base_idx, provider, altpred, 两个预测, 以及各表的索引和tag
+        size_t inflightSize() { return sizeof(UINT32) * (2 * m_tnum + 2); }
+
+        void saveInflight(void* st, ADDRINT addr)
+        {
+            UINT32* p = (UINT32*)st;
+            p[0] = m_base_idx;
+            p[1] = provider_indx;
+            p[2] = altpred_indx;
+            p[3] = (m_provider_pred ? 1 : 0) | (m_alt_pred ? 2 : 0);
+            memcpy(p + 4, m_idx + 1, sizeof(UINT32) * (m_tnum - 1));
+            memcpy(p + 3 + m_tnum, m_tag + 1, sizeof(UINT32) * (m_tnum - 1));
+        }
+
+        void updateTables(const void* st, bool takenActually, bool takenPredicted, ADDRINT addr)
+        {
+            const UINT32* p = (const UINT32*)st;
+            m_base_idx = p[0];
+            provider_indx = p[1];
+            altpred_indx = p[2];
+            m_provider_pred = (p[3] & 1) != 0;
+            m_alt_pred = (p[3] & 2) != 0;
+            memcpy(m_idx + 1, p + 4, sizeof(UINT32) * (m_tnum - 1));
+            memcpy(m_tag + 1, p + 3 + m_tnum, sizeof(UINT32) * (m_tnum - 1));
+            updateEntries(takenActually, takenPredicted);
+        }
+
+        // Shift the global history and the folded copies of every table
+        void updateHistory(bool takenActually, ADDRINT addr)
+        {
+            m_ghr->shiftIn(takenActually);
+            for (size_t i = 1; i < m_tnum; i++) {
+                bool out = m_ghr->bit(m_hist_len[i]);
+                m_idx_fold[i].update(takenActually, out);
+                m_tag_fold[0][i].update(takenActually, out);
+                m_tag_fold[1][i].update(takenActually, out);
+            }
+        }
+
+    private:
+        // Update usefulness, allocate entries and update the provider with the state of predict()
+        void updateEntries(bool takenActually, bool takenPredicted)
+        {
+            // Update usefulness
+            if (provider_indx != 0 && m_provider_pred != m_alt_pred) {
+                UINT32& e = m_entries[m_idx[provider_indx]];
+                UINT32 u = getU(e);
+                if (takenPredicted == takenActually) {
+                    if (u < 3) setU(e, u + 1);
+                } else {
+                    if (u > 0) setU(e, u - 1);
+                }
+            }
+
+            // Entry replacement
+            if (takenPredicted != takenActually) {
+                bool allocated = false;
+                for (size_t i = provider_indx + 1; i < m_tnum; i++) {
+                    UINT32& e = m_entries[m_idx[i]];
+                    if (getU(e) == 0) {
+                        e = pack(m_tag[i], m_ctr_init, 0);
+                        allocated = true;
+                        break;
+                    }
+                }
+                if (!allocated) {
+                    for (size_t i = provider_indx + 1; i < m_tnum; i++) {
+                        UINT32& e = m_entries[m_idx[i]];
+                        if (getU(e) != 0) setU(e, getU(e) - 1);
+                    }
+                }
+            }
+
+            // Reset usefulness periodically
+            m_rst_cnt++;
+            if (m_rst_cnt == m_rst_period)
+            {
+                m_rst_cnt = 0;
+                andWords(m_entries, (m_tnum - 1) << m_entries_log, ~(UINT32)(clear_high ? 1 : 2));
+                clear_high = !clear_high;
+            }
+
+            // Update provider itself
+            if (provider_indx == 0) {
+                m_base.update(m_base_idx, takenActually);
+            } else {
+                UINT32& e = m_entries[m_idx[provider_indx]];
+                UINT32 c = getCtr(e);
+                if (takenActually) { if (c < m_ctr_max) setCtr(e, c + 1); }
+                else { if (c > 0) setCtr(e, c - 1); }
+            }
+        }
+
+    public:
+        int provider() { return provider_indx; }
+
+        // T[1 : m_tnum - 1]各有3个折叠寄存器
+        size_t historySize() { return m_ghr->bytes() + 3 * sizeof(UINT32) * (m_tnum - 1); }
+
+        void getHistory(UINT8* buf)
+        {
+            UINT8* p = copyFolds(m_ghr->copyTo(buf), m_idx_fold + 1, m_tnum - 1);
+            copyFolds(copyFolds(p, m_tag_fold[0] + 1, m_tnum - 1), m_tag_fold[1] + 1, m_tnum - 1);
+        }
+
+        void setHistory(const UINT8* buf)
+        {
+            const UINT8* p = copyFolds(m_ghr->copyFrom(buf), m_idx_fold + 1, m_tnum - 1);
+            copyFolds(copyFolds(p, m_tag_fold[0] + 1, m_tnum - 1), m_tag_fold[1] + 1, m_tnum - 1);
+        }
+
+        // T0的2位计数器, 各表项的tag/计数器/usefulness, 全局历史和usefulness重置计数器
+        UINT64 storageBits()
+        {
+            UINT64 rst_bits = 0;
+            while (((size_t)1 << rst_bits) < m_rst_period) rst_bits++;
+            return m_base.bits() + ((UINT64)(m_tnum - 1) << m_entries_log) * (m_tag_size + m_ctr_width + U_BITS)
+                 + m_hist_len[m_tnum - 1] + rst_bits;
+        }
+        size_t tnum() { return m_tnum; }
+
+        // Whether the provider of the last prediction has a saturated counter
+        bool hasConfidence() { return true; }
+        bool highConfidence()
+        {
+            if (provider_indx == 0) return m_base.get(m_base_idx) == 0 || m_base.get(m_base_idx) == 3;
+            UINT32 c = getCtr(m_entries[m_idx[provider_indx]]);
+            return c == 0 || c == m_ctr_max;
+        }
+
+        // 不经过虚函数调用
+        void runBatch(const BranchRecord* recs, UINT64 n, bool* preds)
+        {
+            for (UINT64 i = 0; i < n; i++)
+            {
+                preds[i] = TAGEPredictor::predict(recs[i].pc);
+                TAGEPredictor::update(recs[i].taken, preds[i], recs[i].pc);
+            }
+        }
+
+        void save(CkptWriter& w)
+        {
+            w.put(m_rst_cnt);
+            w.put(clear_high);
+            m_base.save(w);
+            w.putArray(m_entries, (m_tnum - 1) << m_entries_log);
+            m_ghr->save(w);
+            for (size_t i = 1; i < m_tnum; i++)
+            {
+                w.put(m_idx_fold[i].getVal());
+                w.put(m_tag_fold[0][i].getVal());
+                w.put(m_tag_fold[1][i].getVal());
+            }
+        }
+
+        void load(CkptReader& r)
+        {
+            r.get(m_rst_cnt);
+            r.get(clear_high);
+            m_base.load(r);
+            r.getArray(m_entries, (m_tnum - 1) << m_entries_log);
+            m_ghr->load(r);
+            for (size_t i = 1; i < m_tnum; i++)
+            {
+                UINT32 fold[3] = { 0 };
+                r.getArray(fold, 3);
+                m_idx_fold[i].setVal(fold[0]);
+                m_tag_fold[0][i].setVal(fold[1]);
+                m_tag_fold[1][i].setVal(fold[2]);
+            }
+        }
+};
+
+/* ===================================================================== */
+/* TAGE-SC-L: TAGE + loop predictor + statistical corrector              */
+/* ===================================================================== */
+// 循环预测器: 记录循环分支的迭代次数, 置信度饱和后预测循环出口
+class LoopPredictor
+{
+    static const UINT32 TAG_BITS = 14;
+    static const UINT32 ITER_MAX = 1023;
+    static const UINT8 CONF_MAX = 3;
+    static const UINT8 AGE_INIT = 7;
+
+    struct Entry
+    {
+        UINT16 tag;
+        UINT16 cur;             // 当前迭代次数
+        UINT16 past;            // 上一次循环的迭代次数, 0为未知
+        UINT8 conf;
+        UINT8 age;              // 为0时可被替换
+        bool dir;               // 循环体内的方向
+    };
+
+    const size_t m_entries_log;
+    Entry* m_table;
+
+    // predict时计算, update时复用
+    Entry* m_entry;
+    UINT16 m_tag;
+    bool m_pred;
+
+    public:
+        LoopPredictor(size_t entry_num_log) : m_entries_log(entry_num_log), m_entry(NULL), m_tag(0), m_pred(false)
+        {
+            m_table = new Entry[1 << m_entries_log];
+            memset(m_table, 0, sizeof(Entry) << m_entries_log);
+        }
+
+        ~LoopPredictor() { delete[] m_table; }
+
+        // Return true if the branch hits a confident entry, the prediction is then written to pred
+        bool predict(ADDRINT addr, bool& pred)
+        {
+            m_entry = &m_table[(addr * 0x9e3779b97f4a7c15ULL) >> (64 - m_entries_log)];   // 乘法哈希, 对齐的循环分支也能分散
+            m_tag = truncate(addr, TAG_BITS);
+            if (m_entry->tag != m_tag || m_entry->conf < CONF_MAX) return false;
+            m_pred = m_entry->cur + 1 == m_entry->past ? !m_entry->dir : m_entry->dir;
+            pred = m_pred;
+            return true;
+        }
+
+        // param:   used:           predict返回了true
+        //          tage_mispred:   TAGE是否预测错误, 错误时分配表项
+        void update(bool taken, bool used, bool tage_mispred)
+        {
+            Entry& e = *m_entry;
+            if (e.tag != m_tag)
+            {
+                if (!tage_mispred) return;
+                if (e.age > 0) { e.age--; return; }
+                e.tag = m_tag;
+                e.cur = 0;
+                e.past = 0;
+                e.conf = 0;
+                e.age = AGE_INIT;
+                e.dir = !taken;         // 误预测的多半是循环出口
+                return;
+            }
+
+            if (used && m_pred != taken)
+            {
+                // 置信的预测错了, 丢弃这个循环
+                e.past = 0;
+                e.conf = 0;
+                e.age = 0;
+                e.cur = 0;
+                return;
+            }
+            if (used && e.age < AGE_INIT) e.age++;
+
+            if (taken == e.dir)
+            {
+                if (++e.cur > ITER_MAX) { e.cur = 0; e.past = 0; e.conf = 0; e.age = 0; }
+                return;
+            }
+
+            // 循环出口
+            e.cur++;
+            if (e.cur == e.past)
+            {
+                if (e.conf < CONF_MAX) e.conf++;
+            }
+            else
+            {
+                e.past = e.past == 0 || e.conf == 0 ? e.cur : 0;
+                e.conf = 0;
+            }
+            e.cur = 0;
+        }
+
+        // tag, 两个10位迭代计数, 2位置信度, 3位age和方向
+        UINT64 storageBits() { return (UINT64)(TAG_BITS + 10 + 10 + 2 + 3 + 1) << m_entries_log; }
+
+        void save(CkptWriter& w) { w.putArray(m_table, 1 << m_entries_log); }
+        void load(CkptReader& r) { r.getArray(m_table, 1 << m_entries_log); }
+};
+
+// 统计校正器: GEHL式的6位权重表, 以TAGE的预测为输入, 按全局历史和局部历史索引
+class StatisticalCorrector
+{
+    static const int W_MAX = 31;
+    static const int W_MIN = -32;
+    static const int TC_MAX = 32;
+    static const size_t GLOBAL_TABLES = 4;
+    static const size_t LOCAL_TABLES = 2;
+    static const size_t NTABLES = 1 + GLOBAL_TABLES + LOCAL_TABLES;    // T[0]为bias表
+    static const size_t LOCAL_LOG = 8;                                  // 局部历史表行数的对数
+
+    const size_t m_entries_log;
+    INT8* m_weights;            // T[i]从i << m_entries_log开始
+    ShiftReg* m_ghr;
+    FoldedHistory m_fold[GLOBAL_TABLES];
+    size_t m_glen[GLOBAL_TABLES];
+    size_t m_llen[LOCAL_TABLES];
+    UINT16* m_lhist;            // 局部历史
+
+    // predict时计算, update时复用
+    UINT32 m_idx[NTABLES];
+    int m_sum;
+    UINT32 m_lslot;
+
+    int m_theta;
+    int m_tc;
+
+    public:
+        StatisticalCorrector(size_t entry_num_log) : m_entries_log(entry_num_log), m_sum(0), m_lslot(0), m_theta(14), m_tc(0)
+        {
+            static const size_t glen[GLOBAL_TABLES] = { 4, 10, 20, 40 };
+            static const size_t llen[LOCAL_TABLES] = { 6, 11 };
+
+            m_weights = new INT8[NTABLES << m_entries_log];
+            memset(m_weights, 0, NTABLES << m_entries_log);
+            m_ghr = new ShiftReg(glen[GLOBAL_TABLES - 1]);
+            for (size_t i = 0; i < GLOBAL_TABLES; i++)
+            {
+                m_glen[i] = glen[i];
+                m_fold[i].init(glen[i], m_entries_log);
+            }
+            for (size_t i = 0; i < LOCAL_TABLES; i++) m_llen[i] = llen[i];
+            m_lhist = new UINT16[1 << LOCAL_LOG];
+            memset(m_lhist, 0, sizeof(UINT16) << LOCAL_LOG);
+        }
+
+        ~StatisticalCorrector()
+        {
+            delete[] m_weights;
+            delete m_ghr;
+            delete[] m_lhist;
+        }
+
+        // param:   tage_pred:  TAGE的预测
+        //          high_conf:  TAGE的provider计数器是否饱和
+        // Return the corrector's prediction; strong is set when it is allowed to override TAGE
+        bool predict(ADDRINT addr, bool tage_pred, bool high_conf, bool& strong)
+        {
+            ADDRINT pc = addr ^ (addr >> m_entries_log);
+            m_lslot = truncate(addr, LOCAL_LOG);
+            UINT16 lhist = m_lhist[m_lslot];
+
+            m_idx[0] = truncate((pc << 2) | (tage_pred << 1) | high_conf, m_entries_log);
+            for (size_t i = 0; i < GLOBAL_TABLES; i++)
+                m_idx[1 + i] = truncate(((pc ^ m_fold[i].getVal()) << 1) | tage_pred, m_entries_log);
+            for (size_t i = 0; i < LOCAL_TABLES; i++)
+                m_idx[1 + GLOBAL_TABLES + i] = truncate(((pc ^ ((lhist & ((1 << m_llen[i]) - 1)) << 3)) << 1) | tage_pred, m_entries_log);
+
+            m_sum = 0;
+            for (size_t i = 0; i < NTABLES; i++)
+            {
+                m_idx[i] += i << m_entries_log;
+                m_sum += 2 * m_weights[m_idx[i]] + 1;
+            }
+
+            bool pred = m_sum >= 0;
+            strong = !high_conf || abs(m_sum) >= m_theta;
+            return pred;
+        }
+
+        void update(bool taken, bool sc_pred, bool tage_pred)
+        {
+            if (sc_pred != taken || abs(m_sum) < m_theta)
+            {
+                for (size_t i = 0; i < NTABLES; i++)
+                {
+                    INT8& w = m_weights[m_idx[i]];
+                    if (taken) { if (w < W_MAX) w++; }
+                    else { if (w > W_MIN) w--; }
+                }
+            }
+
+            // 只在与TAGE意见不同时调整阈值
+            if (sc_pred != tage_pred)
+            {
+                if (sc_pred != taken)
+                {
+                    if (++m_tc >= TC_MAX) { m_theta++; m_tc = 0; }
+                }
+                else
+                {
+                    if (--m_tc <= -TC_MAX) { if (m_theta > 0) m_theta--; m_tc = 0; }
+                }
+            }
+
+            m_ghr->shiftIn(taken);
+            for (size_t i = 0; i < GLOBAL_TABLES; i++) m_fold[i].update(taken, m_ghr->bit(m_glen[i]));
+            m_lhist[m_lslot] = ((m_lhist[m_lslot] << 1) | taken) & ((1 << m_llen[LOCAL_TABLES - 1]) - 1);
+        }
+
+        // 只有全局历史, 局部历史表按PC索引, 与表一样共享
+        size_t historySize() { return m_ghr->bytes() + sizeof(UINT32) * GLOBAL_TABLES; }
+        void getHistory(UINT8* buf) { copyFolds(m_ghr->copyTo(buf), m_fold, GLOBAL_TABLES); }
+        void setHistory(const UINT8* buf) { copyFolds(m_ghr->copyFrom(buf), m_fold, GLOBAL_TABLES); }
+
+        // 6位权重, 全局历史, 局部历史表, 以及阈值和阈值计数器
+        UINT64 storageBits()
+        {
+            return ((UINT64)6 * NTABLES << m_entries_log) + m_glen[GLOBAL_TABLES - 1]
+                 + ((UINT64)m_llen[LOCAL_TABLES - 1] << LOCAL_LOG) + 7 + 7;
+        }
+
+        void save(CkptWriter& w)
+        {
+            w.put(m_theta);
+            w.put(m_tc);
+            w.putArray(m_weights, NTABLES << m_entries_log);
+            w.putArray(m_lhist, 1 << LOCAL_LOG);
+            m_ghr->save(w);
+            for (size_t i = 0; i < GLOBAL_TABLES; i++) w.put(m_fold[i].getVal());
+        }
+
+        void load(CkptReader& r)
+        {
+            r.get(m_theta);
+            r.get(m_tc);
+            r.getArray(m_weights, NTABLES << m_entries_log);
+            r.getArray(m_lhist, 1 << LOCAL_LOG);
+            m_ghr->load(r);
+            for (size_t i = 0; i < GLOBAL_TABLES; i++)
+            {
+                UINT32 fold = 0;
+                r.get(fold);
+                m_fold[i].setVal(fold);
+            }
+        }
+};
+
+// 最终预测: 循环预测器置信时用它, 否则统计校正器可以推翻TAGE
+class TAGESCLPredictor: public BranchPredictor
+{
+    BranchPredictor* m_tage;            // 任一哈希函数实例化的TAGEPredictor
+    size_t m_tage_tnum;
+    LoopPredictor* m_loop;              // NULL为不使用
+    StatisticalCorrector* m_sc;         // NULL为不使用
+    INT32 m_with_loop;                  // 循环预测器比TAGE更准时增加, 小于0时不用循环预测器
+
+    // predict时计算, update时复用
+    bool m_tage_pred;
+    bool m_loop_hit;
+    bool m_loop_pred;
+    bool m_loop_used;
+    bool m_sc_pred;
+    bool m_sc_used;
+
+    // 各组件推翻前一级预测的次数和其中正确的次数
+    UINT64 m_loop_overrides;
+    UINT64 m_loop_correct;
+    UINT64 m_sc_overrides;
+    UINT64 m_sc_correct;
+
+    public:
+        // param:   tage:       TAGE, owned by this predictor
+        //          tnum:       TAGE的表个数, 循环预测器和统计校正器的provider编号排在其后
+        //          loop_log:   循环预测器行数的对数, 0为不使用
+        //          sc_log:     统计校正器每张表行数的对数, 0为不使用
+        TAGESCLPredictor(BranchPredictor* tage, size_t tnum, size_t loop_log, size_t sc_log)
+        : m_tage(tage), m_tage_tnum(tnum), m_loop(loop_log ? new LoopPredictor(loop_log) : NULL),
+          m_sc(sc_log ? new StatisticalCorrector(sc_log) : NULL), m_with_loop(-1),
+          m_tage_pred(false), m_loop_hit(false), m_loop_pred(false), m_loop_used(false), m_sc_pred(false), m_sc_used(false),
+          m_loop_overrides(0), m_loop_correct(0), m_sc_overrides(0), m_sc_correct(0)
+        {}
+
+        ~TAGESCLPredictor()
+        {
+            delete m_tage;
+            delete m_loop;
+            delete m_sc;
+        }
+
+        bool predict(ADDRINT addr)
+        {
+            m_tage_pred = m_tage->predict(addr);
+            bool pred = m_tage_pred;
+
+            m_loop_hit = m_loop && m_loop->predict(addr, m_loop_pred);
+            m_loop_used = m_loop_hit && m_with_loop >= 0;
+            if (m_loop_used) pred = m_loop_pred;
+
+            m_sc_used = false;
+            if (m_sc)
+            {
+                bool strong = false;
+                m_sc_pred = m_sc->predict(addr, m_tage_pred, m_tage->highConfidence(), strong);
+                m_sc_used = !m_loop_used && strong && m_sc_pred != m_tage_pred;
+                if (m_sc_used) pred = m_sc_pred;
+            }
+            return pred;
+        }
+
+        void update(bool takenActually, bool takenPredicted, ADDRINT addr)
+        {
+            if (m_loop_used && m_loop_pred != m_tage_pred)
+            {
+                m_loop_overrides++;
+                if (m_loop_pred == takenActually) m_loop_correct++;
+            }
+            if (m_sc_used)
+            {
+                m_sc_overrides++;
+                if (m_sc_pred == takenActually) m_sc_correct++;
+            }
+
+            if (m_loop)
+            {
+                if (m_loop_hit && m_loop_pred != m_tage_pred)
+                {
+                    if (m_loop_pred == takenActually) { if (m_with_loop < 63) m_with_loop++; }
+                    else { if (m_with_loop > -64) m_with_loop--; }
+                }
+                m_loop->update(takenActually, m_loop_hit, m_tage_pred != takenActually);
+            }
+            if (m_sc) m_sc->update(takenActually, m_sc_pred, m_tage_pred);
+            m_tage->update(takenActually, m_tage_pred, addr);
+        }
+
+        // 不经过虚函数调用
+        void runBatch(const BranchRecord* recs, UINT64 n, bool* preds)
+        {
+            for (UINT64 i = 0; i < n; i++)
+            {
+                preds[i] = TAGESCLPredictor::predict(recs[i].pc);
+                TAGESCLPredictor::update(recs[i].taken, preds[i], recs[i].pc);
+            }
+        }
+
+        // 循环预测器只在置信度饱和时给出预测; 统计校正器推翻TAGE时视为低置信度
+        bool hasConfidence() { return true; }
+        bool highConfidence()
+        {
+            if (m_loop_used) return true;
+            if (m_sc_used) return false;
+            return m_tage->highConfidence();
+        }
+
+        // 0 - tnum-1: TAGE的provider, tnum: 循环预测器, tnum + 1: 统计校正器
+        int provider()
+        {
+            if (m_loop_used) return m_tage_tnum;
+            if (m_sc_used) return m_tage_tnum + 1;
+            return m_tage->provider();
+        }
+
+        UINT64 storageBits()
+        {
+            return m_tage->storageBits() + (m_loop ? m_loop->storageBits() + 7 : 0) + (m_sc ? m_sc->storageBits() : 0);
+        }
+
+        // 循环预测器没有全局历史
+        size_t historySize() { return m_tage->historySize() + (m_sc ? m_sc->historySize() : 0); }
+
+        void getHistory(UINT8* buf)
+        {
+            m_tage->getHistory(buf);
+            if (m_sc) m_sc->getHistory(buf + m_tage->historySize());
+        }
+
+        void setHistory(const UINT8* buf)
+        {
+            m_tage->setHistory(buf);
+            if (m_sc) m_sc->setHistory(buf + m_tage->historySize());
+        }
+
+        void resetStats() { m_loop_overrides = m_loop_correct = m_sc_overrides = m_sc_correct = 0; }
+
+        std::string report()
+        {
+            char buf[256];
+            snprintf(buf, sizeof(buf), "  loop overrides: %lu (%lu correct), SC overrides: %lu (%lu correct)",
+                     m_loop_overrides, m_loop_correct, m_sc_overrides, m_sc_correct);
+            return buf;
+        }
+
+        void save(CkptWriter& w)
+        {
+            m_tage->save(w);
+            w.put(m_with_loop);
+            if (m_loop) m_loop->save(w);
+            if (m_sc) m_sc->save(w);
+        }
+
+        void load(CkptReader& r)
+        {
+            m_tage->load(r);
+            r.get(m_with_loop);
+            if (m_loop) m_loop->load(r);
+            if (m_sc) m_sc->load(r);
+        }
+};
+
+/* ===================================================================== */
+/* Hashed perceptron                                                     */
+/* ===================================================================== */
+// SIMD kernels over a contiguous vector of int8 weights, n is a multiple of PERCEPTRON_LANES
+#if defined(__AVX2__)
+static const size_t PERCEPTRON_LANES = 32;
+
+inline int sumWeights(const INT8* w, size_t n)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc = _mm256_setzero_si256();
+    for (size_t i = 0; i < n; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(w + i));
+        __m256i lo = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(v));
+        __m256i hi = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(v, 1));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_add_epi16(lo, hi), ones));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+    return _mm_cvtsi128_si32(s);
+}
+
+// w[i] += d with int8 saturation
+inline void addWeights(INT8* w, size_t n, INT8 d)
+{
+    const __m256i vd = _mm256_set1_epi8(d);
+    for (size_t i = 0; i < n; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(w + i));
+        _mm256_storeu_si256((__m256i*)(w + i), _mm256_adds_epi8(v, vd));
+    }
+}
+#elif defined(__SSE2__)
+static const size_t PERCEPTRON_LANES = 16;
+
+inline int sumWeights(const INT8* w, size_t n)
+{
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    for (size_t i = 0; i < n; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(w + i));
+        __m128i sign = _mm_cmpgt_epi8(zero, v);             // 符号扩展到16位
+        __m128i lo = _mm_unpacklo_epi8(v, sign);
+        __m128i hi = _mm_unpackhi_epi8(v, sign);
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_add_epi16(lo, hi), ones));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4e));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xb1));
+    return _mm_cvtsi128_si32(acc);
+}
+
+inline void addWeights(INT8* w, size_t n, INT8 d)
+{
+    const __m128i vd = _mm_set1_epi8(d);
+    for (size_t i = 0; i < n; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(w + i));
+        _mm_storeu_si128((__m128i*)(w + i), _mm_adds_epi8(v, vd));
+    }
+}
+#else
+static const size_t PERCEPTRON_LANES = 1;
+
+inline int sumWeights(const INT8* w, size_t n)
+{
+    int sum = 0;
+    for (size_t i = 0; i < n; i++) sum += w[i];
+    return sum;
+}
+
+inline void addWeights(INT8* w, size_t n, INT8 d)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        int v = w[i] + d;
+        w[i] = v > 127 ? 127 : (v < -128 ? -128 : v);
+    }
+}
+#endif
+
+// 每张表的int8权重由PC和一段全局历史的折叠值哈希索引, T[0]只用PC (bias).
+// 预测时把各表选中的权重收集到一个连续向量, 由SIMD求和; 训练时整体饱和加减后写回.
+class HashedPerceptronPredictor: public BranchPredictor
+{
+    static const int TC_MAX = 64;   // 阈值自适应计数器的范围
+
+    const size_t m_tnum;
+    const size_t m_entries_log;
+    const size_t m_padded;          // m_tnum向上取整到PERCEPTRON_LANES的倍数
+    INT8* m_weights;                // T[i]从i << m_entries_log开始
+    size_t* m_hist_len;
+    ShiftReg* m_ghr;
+    FoldedHistory* m_fold;
+
+    // predict时计算, update时复用
+    UINT32* m_idx;
+    INT8* m_gathered;               // 各表选中的权重, 末尾补0
+    int m_sum;
+
+    int m_theta;                    // 训练阈值
+    int m_tc;
+
+    public:
+        // Constructor
+        // param:   tnum:               权重表个数, 含bias表T[0]
+        //          entry_num_log:      每张表行数的对数
+        //          hist_min, hist_max: T[1]和T[tnum - 1]的历史长度, 中间按几何级数
+        HashedPerceptronPredictor(size_t tnum, size_t entry_num_log, size_t hist_min, size_t hist_max)
+        : m_tnum(tnum), m_entries_log(entry_num_log),
+          m_padded((tnum + PERCEPTRON_LANES - 1) / PERCEPTRON_LANES * PERCEPTRON_LANES),
+          m_sum(0), m_theta((int)(1.93 * tnum + 14)), m_tc(0)
+        {
+            m_weights = new INT8[m_tnum << m_entries_log];
+            memset(m_weights, 0, m_tnum << m_entries_log);
+            m_hist_len = new size_t[m_tnum];
+            m_fold = new FoldedHistory[m_tnum];
+            m_idx = new UINT32[m_tnum];
+            m_gathered = new INT8[m_padded];
+            memset(m_gathered, 0, m_padded);
+
+            m_hist_len[0] = 0;
+            for (size_t i = 1; i < m_tnum; i++)
+            {
+                double r = m_tnum > 2 ? double(i - 1) / (m_tnum - 2) : 0;
+                m_hist_len[i] = (size_t)(hist_min * pow((double)hist_max / hist_min, r) + 0.5);
+                m_fold[i].init(m_hist_len[i], m_entries_log);
+            }
+            m_ghr = new ShiftReg(m_hist_len[m_tnum - 1] > 0 ? m_hist_len[m_tnum - 1] : 1);
+        }
+
+        ~HashedPerceptronPredictor()
+        {
+            delete[] m_weights;
+            delete[] m_hist_len;
+            delete[] m_fold;
+            delete[] m_idx;
+            delete[] m_gathered;
+            delete m_ghr;
+        }
+
+        bool predict(ADDRINT addr)
+        {
+            ADDRINT pc = addr ^ (addr >> m_entries_log);
+            for (size_t i = 0; i < m_tnum; i++)
+            {
+                m_idx[i] = (i << m_entries_log) + (UINT32)truncate(pc ^ (m_fold[i].getVal() * 3), m_entries_log);
+                m_gathered[i] = m_weights[m_idx[i]];
+            }
+            m_sum = sumWeights(m_gathered, m_padded);
+            return m_sum >= 0;
+        }
+
+        void update(bool takenActually, bool takenPredicted, ADDRINT addr)
+        {
+            bool mispred = takenActually != takenPredicted;
+            if (mispred || abs(m_sum) <= m_theta)
+            {
+                addWeights(m_gathered, m_padded, takenActually ? 1 : -1);
+                for (size_t i = 0; i < m_tnum; i++) m_weights[m_idx[i]] = m_gathered[i];
+                for (size_t i = m_tnum; i < m_padded; i++) m_gathered[i] = 0;
+
+                // O-GEHL的阈值自适应: 误预测多则提高阈值, 低置信度的正确预测多则降低
+                if (mispred)
+                {
+                    if (++m_tc >= TC_MAX) { m_theta++; m_tc = 0; }
+                }
+                else
+                {
+                    if (--m_tc <= -TC_MAX) { if (m_theta > 0) m_theta--; m_tc = 0; }
+                }
+            }
+
+            m_ghr->shiftIn(takenActually);
+            for (size_t i = 1; i < m_tnum; i++)
+                m_fold[i].update(takenActually, m_ghr->bit(m_hist_len[i]));
+        }
+
+        // 不经过虚函数调用
+        void runBatch(const BranchRecord* recs, UINT64 n, bool* preds)
+        {
+            for (UINT64 i = 0; i < n; i++)
+            {
+                preds[i] = HashedPerceptronPredictor::predict(recs[i].pc);
+                HashedPerceptronPredictor::update(recs[i].taken, preds[i], recs[i].pc);
+            }
+        }
+
+        size_t historySize() { return m_ghr->bytes() + sizeof(UINT32) * (m_tnum - 1); }
+        void getHistory(UINT8* buf) { copyFolds(m_ghr->copyTo(buf), m_fold + 1, m_tnum - 1); }
+        void setHistory(const UINT8* buf) { copyFolds(m_ghr->copyFrom(buf), m_fold + 1, m_tnum - 1); }
+
+        // 8位权重, 全局历史, 阈值和阈值计数器
+        UINT64 storageBits() { return ((UINT64)8 * m_tnum << m_entries_log) + m_hist_len[m_tnum - 1] + 8 + 8; }
+
+        void save(CkptWriter& w)
+        {
+            w.put(m_theta);
+            w.put(m_tc);
+            w.putArray(m_weights, m_tnum << m_entries_log);
+            m_ghr->save(w);
+            for (size_t i = 1; i < m_tnum; i++) w.put(m_fold[i].getVal());
+        }
+
+        void load(CkptReader& r)
+        {
+            r.get(m_theta);
+            r.get(m_tc);
+            r.getArray(m_weights, m_tnum << m_entries_log);
+            m_ghr->load(r);
+            for (size_t i = 1; i < m_tnum; i++)
+            {
+                UINT32 fold = 0;
+                r.get(fold);
+                m_fold[i].setVal(fold);
+            }
+        }
+};
+
+/* ===================================================================== */
+/* Delayed update: tables are updated N branches after the prediction   */
+/* ===================================================================== */
+// 历史在预测时推测更新, 预测错误时立即修复; trace只含正确路径, 修复后的历史就是实际结果,
+// 因此历史等价于用实际结果立即更新. 计数器/usefulness/分配用预测时保存的索引, 延迟N条分支才更新
+class DelayedUpdatePredictor: public BranchPredictor
+{
+    struct Inflight
+    {
+        ADDRINT addr;
+        bool taken;
+        bool pred;
+    };
+
+    BranchPredictor* m_bp;
+    const size_t m_delay;           // 表更新前还要经过的分支数
+    const size_t m_size;            // 环形队列项数: 这m_delay条分支加上等待更新的那一条
+    const size_t m_st_size;         // 每条分支的在途状态字节数
+    UINT8* m_states;                // 环形队列, m_size项
+    Inflight* m_queue;
+    size_t m_head;                  // 最老的一项
+    size_t m_count;
+
+    public:
+        // param:   bp:     predictor whose inflightSize() is not 0, owned by this predictor
+        //          delay:  表更新相对预测延迟的分支数
+        DelayedUpdatePredictor(BranchPredictor* bp, size_t delay)
+        : m_bp(bp), m_delay(delay), m_size(delay + 1), m_st_size(bp->inflightSize()), m_head(0), m_count(0)
+        {
+            m_states = new UINT8[m_size * m_st_size];
+            m_queue = new Inflight[m_size];
+        }
+
+        ~DelayedUpdatePredictor()
+        {
+            delete m_bp;
+            delete[] m_states;
+            delete[] m_queue;
+        }
+
+        bool predict(ADDRINT addr)
+        {
+            bool pred = m_bp->predict(addr);
+            // 队列最多m_delay项, 总有一个空位留给这条分支
+            m_bp->saveInflight(m_states + ((m_head + m_count) % m_size) * m_st_size, addr);
+            return pred;
+        }
+
+        void update(bool takenActually, bool takenPredicted, ADDRINT addr)
+        {
+            m_bp->updateHistory(takenActually, addr);
+            Inflight& f = m_queue[(m_head + m_count) % m_size];
+            f.addr = addr;
+            f.taken = takenActually;
+            f.pred = takenPredicted;
+            // 最老的分支之后又有m_delay条分支完成时才更新它的表, delay=1即落后一条分支
+            if (++m_count <= m_delay) return;
+
+            const Inflight& old = m_queue[m_head];
+            m_bp->updateTables(m_states + m_head * m_st_size, old.taken, old.pred, old.addr);
+            m_head = (m_head + 1) % m_size;
+            m_count--;
+        }
+
+        int provider() { return m_bp->provider(); }
+        UINT64 storageBits() { return m_bp->storageBits(); }
+        bool hasConfidence() { return m_bp->hasConfidence(); }
+        bool highConfidence() { return m_bp->highConfidence(); }
+
+        // 在途队列属于流水线, 不随线程切换
+        size_t historySize() { return m_bp->historySize(); }
+        void getHistory(UINT8* buf) { m_bp->getHistory(buf); }
+        void setHistory(const UINT8* buf) { m_bp->setHistory(buf); }
+        void resetStats() { m_bp->resetStats(); }
+        std::string report() { return m_bp->report(); }
+
+        void save(CkptWriter& w)
+        {
+            m_bp->save(w);
+            w.put(m_head);
+            w.put(m_count);
+            w.putArray(m_states, m_size * m_st_size);
+            w.putArray(m_queue, m_size);
+        }
+
+        void load(CkptReader& r)
+        {
+            m_bp->load(r);
+            r.get(m_head);
+            r.get(m_count);
+            r.getArray(m_states, m_size * m_st_size);
+            r.getArray(m_queue, m_size);
+        }
+};
+
+/* ===================================================================== */
+/* Predictor specs: "name:key=value,key=value,..."                       */
+/* ===================================================================== */
+class PredictorSpec
+{
+    public:
+        // Return false if the spec is malformed
+        bool parse(const std::string& spec)
+        {
+            size_t colon = spec.find(':');
+            m_name = spec.substr(0, colon);
+            m_args.clear();
+            m_used.clear();
+            m_error.clear();
+            if (colon == std::string::npos) return !m_name.empty();
+
+            size_t pos = colon + 1;
+            while (pos <= spec.size())
+            {
+                size_t comma = spec.find(',', pos);
+                if (comma == std::string::npos) comma = spec.size();
+                std::string item = spec.substr(pos, comma - pos);
+                size_t eq = item.find('=');
+                if (eq == std::string::npos || eq == 0 || eq + 1 == item.size()) return false;
+                m_args.push_back(std::make_pair(item.substr(0, eq), item.substr(eq + 1)));
+                m_used.push_back(false);
+                pos = comma + 1;
+            }
+            return !m_name.empty();
+        }
+
+        const std::string& name() { return m_name; }
+
+        // 数值参数必须在[lo, hi]内; 不合法时记下错误并返回默认值, 保证构造不会出错, 由newPredictor报告
+        double get(const char* key, double def, double lo, double hi)
+        {
+            const std::string* val = find(key);
+            if (val == NULL) return def;
+            char* end;
+            double v = strtod(val->c_str(), &end);
+            if (*end != '\0' || !(v >= lo && v <= hi))
+            {
+                char msg[128];
+                snprintf(msg, sizeof(msg), "%s=%s, expected a number in [%g, %g]", key, val->c_str(), lo, hi);
+                fail(msg);
+                return def;
+            }
+            return v;
+        }
+
+        size_t getSize(const char* key, size_t def, size_t lo, size_t hi)
+        {
+            const std::string* val = find(key);
+            if (val == NULL) return def;
+            const char* str = val->c_str();
+            char* end = (char*)str;
+            unsigned long long v = isdigit((unsigned char)str[0]) ? strtoull(str, &end, 10) : 0;    // 拒绝负号
+            if (end == str || *end != '\0' || v < lo || v > hi)
+            {
+                char msg[128];
+                snprintf(msg, sizeof(msg), "%s=%s, expected an integer in [%lu, %lu]", key, str, (unsigned long)lo, (unsigned long)hi);
+                fail(msg);
+                return def;
+            }
+            return (size_t)v;
+        }
+
+        std::string getString(const char* key, const char* def)
+        {
+            const std::string* val = find(key);
+            return val ? *val : def;
+        }
+
+        // Record a bad parameter; only the first one is reported
+        void fail(const std::string& msg) { if (m_error.empty()) m_error = msg; }
+        const std::string& error() { return m_error; }
+
+        // Return the first key no predictor asked for, or "" if all were used
+        std::string unusedKey()
+        {
+            for (size_t i = 0; i < m_args.size(); i++)
+                if (!m_used[i]) return m_args[i].first;
+            return "";
+        }
+
+    private:
+        std::string m_name;
+        std::vector<std::pair<std::string, std::string> > m_args;
+        std::vector<bool> m_used;
+        std::string m_error;
+
+        const std::string* find(const char* key)
+        {
+            for (size_t i = 0; i < m_args.size(); i++)
+            {
+                if (m_args[i].first != key) continue;
+                m_used[i] = true;
+                return &m_args[i].second;
+            }
+            return NULL;
+        }
+};
+
+// Constructors of the hash-templated predictors: gshare has one instantiation per index hash,
+// TAGE one per (index hash, tag hash) pair
+typedef BranchPredictor* (*MakeFn)(PredictorSpec& s);
+
+template<HashFn h1>
+BranchPredictor* makeGshare(PredictorSpec& s)
+{
+    return new GlobalHistoryPredictor<h1>(s.getSize("ghr", 22, 1, 65536), s.getSize("log", 11, 1, 28), s.getSize("ctr", 2, 1, 8));
+}
+
+template<HashFn h1, HashFn h2>
+BranchPredictor* makeTAGE(PredictorSpec& s)
+{
+    // tag + ctr + U_BITS不超过32由两者的范围保证; 最长历史另外检查, 过长时ShiftReg无法分配
+    size_t tnum = s.getSize("tnum", 8, 2, 32), hist1 = s.getSize("h1", 2, 1, 1024);
+    double alpha = s.get("alpha", 2, 1, 8);
+    if (hist1 * pow(alpha, (double)(tnum - 2)) > 65536)
+    {
+        s.fail("the longest history h1 * alpha^(tnum - 2) exceeds 65536");
+        return NULL;
+    }
+    return new TAGEPredictor<h1, h2>(tnum, s.getSize("t0", 14, 1, 28), hist1, (float)alpha, s.getSize("log", 11, 1, 24),
+                                     s.getSize("tag", 12, 2, 24), s.getSize("ctr", 3, 1, 6),
+                                     s.getSize("rst", 256 * 1024, 1, 1ULL << 32));
+}
+
+// 与HASH_NAMES的顺序相同
+#define HASH_ROW(make) { make<f_xor>, make<f_xnor>, make<f_crc>, make<f_mul>, make<f_skew> }
+#define HASH_TABLE_ROW(make, h1) { make<h1, f_xor>, make<h1, f_xnor>, make<h1, f_crc>, make<h1, f_mul>, make<h1, f_skew> }
+#define HASH_TABLE(make) { HASH_TABLE_ROW(make, f_xor), HASH_TABLE_ROW(make, f_xnor), HASH_TABLE_ROW(make, f_crc), \
+                           HASH_TABLE_ROW(make, f_mul), HASH_TABLE_ROW(make, f_skew) }
+static const MakeFn GSHARE_MAKERS[NHASH] = HASH_ROW(makeGshare);
+static const MakeFn TAGE_MAKERS[NHASH][NHASH] = HASH_TABLE(makeTAGE);
+
+// Index of the hash function named by key, -1 (after printing the reason) if unknown
+int specHash(PredictorSpec& s, const char* key, const char* def, const std::string& spec)
+{
+    std::string name = s.getString(key, def);
+    int idx = hashIndex(name);
+    if (idx < 0) fprintf(stderr, "unknown hash '%s' in spec '%s', expected xor, xnor, crc, mul or skew\n", name.c_str(), spec.c_str());
+    return idx;
+}
+
+// Pick the TAGE instantiation named by the hash and taghash keys; on failure print the reason and return NULL
+BranchPredictor* makeHashed(const MakeFn (*makers)[NHASH], PredictorSpec& s, const std::string& spec)
+{
+    int idx = specHash(s, "hash", "xor", spec);
+    if (idx < 0) return NULL;
+    int tag = specHash(s, "taghash", "xnor", spec);
+    if (tag < 0) return NULL;
+    return makers[idx][tag](s);
+}
+
+// Report a malformed spec and free what was built
+BranchPredictor* specError(PredictorSpec& s, BranchPredictor* bp, const std::string& spec)
+{
+    fprintf(stderr, "malformed predictor spec '%s': %s\n", spec.c_str(), s.error().c_str());
+    delete bp;
+    return NULL;
+}
+
+// Build a predictor from a spec; on failure print the reason and return NULL
+//   bht:log=14,ctr=2
+//   gshare:ghr=22,log=11,ctr=2
+//   local:bht=10,hist=10,pht=0,ctr=3               (pht为PHT组数的对数: PAg为0, PAp为bht, SAg为bht较小且pht=0)
+//   tournament:log=14,ghr=13,glog=13,sel=2,lhist=0 (BHT vs. gshare; lhist > 0时BHT换成log行lhist位的局部历史预测器)
+//   tage:tnum=8,t0=14,h1=2,alpha=2,log=11,tag=12,ctr=3,rst=262144
+//   tagescl:<tage的参数>,loop=6,sc=10                 (loop/sc为循环预测器/统计校正器表大小的对数, 0为关闭)
+//   perceptron:tables=16,log=11,hmin=3,hmax=200     (默认32KB, 与默认TAGE的存储量相当)
+// bht, gshare, local和tage还可以加delay=N: 历史立即更新, 表在N条分支之后才更新
+// gshare, tage和tagescl还可以加hash=选择索引的哈希函数, tage和tagescl还可以加taghash=选择tag的:
+// xor, xnor, crc, mul, skew (默认xor, xnor); gshare没有tag, 给taghash=报未知参数
+// 参数值须为范围内的十进制数 (alpha可为小数), 否则报告malformed spec并返回NULL
+BranchPredictor* newPredictor(const std::string& spec)
+{
+    PredictorSpec s;
+    if (!s.parse(spec))
+    {
+        fprintf(stderr, "malformed predictor spec '%s', expected name:key=value,...\n", spec.c_str());
+        return NULL;
+    }
+
+    BranchPredictor* bp = NULL;
+    if (s.name() == "bht")
+    {
+        bp = new BHTPredictor(s.getSize("log", 14, 1, 28), s.getSize("ctr", 2, 1, 8));
+    }
+    else if (s.name() == "gshare")
+    {
+        int idx = specHash(s, "hash", "xor", spec);
+        if (idx < 0) return NULL;
+        bp = GSHARE_MAKERS[idx](s);
+    }
+    else if (s.name() == "local")
+    {
+        bp = new LocalHistoryPredictor(s.getSize("bht", 10, 1, 24), s.getSize("hist", 10, 1, 16), s.getSize("pht", 0, 0, 12),
+                                       s.getSize("ctr", 3, 1, 8));
+    }
+    else if (s.name() == "tournament")
+    {
+        // lhist > 0时以局部历史预测器代替BHT; 选择器仍是一个全局的饱和计数器, 不按PC或历史索引,
+        // 因此不同于21264那样用选择表逐分支挑选local/global
+        size_t lhist = s.getSize("lhist", 0, 0, 16);
+        BranchPredictor* bp0 = lhist ? (BranchPredictor*)new LocalHistoryPredictor(s.getSize("log", 10, 1, 24), lhist, 0, 3)
+                                     : new BHTPredictor(s.getSize("log", 14, 1, 28));
+        bp = new TournamentPredictor(bp0,
+                                     new GlobalHistoryPredictor<f_xor>(s.getSize("ghr", 13, 1, 65536),
+                                                                       s.getSize("glog", 13, 1, 28)),
+                                     s.getSize("sel", 2, 1, 8));
+    }
+    else if (s.name() == "tage")
+    {
+        bp = makeHashed(TAGE_MAKERS, s, spec);
+        if (bp == NULL && s.error().empty()) return NULL;
+    }
+    else if (s.name() == "tagescl")
+    {
+        BranchPredictor* tage = makeHashed(TAGE_MAKERS, s, spec);
+        if (tage == NULL && s.error().empty()) return NULL;
+        if (tage == NULL) return specError(s, NULL, spec);
+        bp = new TAGESCLPredictor(tage, s.getSize("tnum", 8, 2, 32), s.getSize("loop", 6, 0, 20), s.getSize("sc", 10, 0, 20));
+    }
+    else if (s.name() == "perceptron")
+    {
+        size_t hmin = s.getSize("hmin", 3, 1, 65536), hmax = s.getSize("hmax", 200, 1, 65536);
+        if (hmax < hmin) s.fail("hmax must not be smaller than hmin");
+        bp = new HashedPerceptronPredictor(s.getSize("tables", 16, 1, 64), s.getSize("log", 11, 1, 20), hmin, hmax);
+    }
+    else
+    {
+        fprintf(stderr, "unknown predictor '%s' in spec '%s'\n", s.name().c_str(), spec.c_str());
+        return NULL;
+    }
+
+    if (!s.error().empty()) return specError(s, bp, spec);
+
+    // delay=N: 表的更新延迟N条分支, 0为立即更新
+    size_t delay = s.getSize("delay", 0, 0, 65536);
+    if (!s.error().empty()) return specError(s, bp, spec);
+    if (delay)
+    {
+        if (bp->inflightSize() == 0)
+        {
+            fprintf(stderr, "predictor '%s' does not support delay in spec '%s'\n", s.name().c_str(), spec.c_str());
+            delete bp;
+            return NULL;
+        }
+        bp = new DelayedUpdatePredictor(bp, delay);
+    }
+
+    std::string unused = s.unusedKey();
+    if (!unused.empty())
+    {
+        fprintf(stderr, "unknown parameter '%s' in spec '%s'\n", unused.c_str(), spec.c_str());
+        delete bp;
+        return NULL;
+    }
+    return bp;
+}
+
+#endif
@@ -0,0 +1,343 @@
+/**************************************
+ * Offline replay of a branch trace written by brchPredict -trace
+ * usage: brchReplay <trace> [spec ...]
+ *        brchReplay -search <KB> [-threads N] <trace>
+ *        brchReplay -hashbench <trace>
+ * spec与brchPredict的-bp相同, 默认为brchPredict的默认预测器
+ * -search在存储预算内枚举TAGE的配置, 并行回放, 输出MPKI与存储量的Pareto前沿
+ * -hashbench比较各哈希函数的别名率, 每次哈希的耗时和作为gshare索引时的误预测
+ * 不需要Pin, 用于快速比较预测器
+**************************************/
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+#include "brchTrace.h"
+#include "brchTarget.h"
+
+struct ReplaySlot
+{
+    const char* spec;
+    BranchPredictor* bp;
+    UINT64 counters[4];         // takenCorrect, takenIncorrect, notTakenCorrect, notTakenIncorrect
+    double secs;
+};
+
+// 每1000条指令的误预测数, trace没有指令数时按每1000条条件分支
+double perKilo(UINT64 mispreds, UINT64 instructions, UINT64 conds)
+{
+    UINT64 base = instructions ? instructions : conds;
+    return base ? 1000.0 * mispreds / base : 0;
+}
+
+/* ===================================================================== */
+/* Budget-constrained search                                             */
+/* ===================================================================== */
+struct Candidate
+{
+    std::string spec;
+    UINT64 bits;
+    UINT64 mispreds;
+    UINT64 conds;
+};
+
+bool cmpBits(const Candidate& a, const Candidate& b)
+{
+    return a.bits < b.bits || (a.bits == b.bits && a.mispreds < b.mispreds);
+}
+
+// 表个数, 最短历史, 几何倍数, tag宽度, 表项数; T0固定为tagged表的4倍
+void enumerateTAGE(UINT64 budget_bits, std::vector<Candidate>& out)
+{
+    static const size_t tnums[] = { 4, 5, 6, 7, 8, 10, 12 };
+    static const size_t h1s[] = { 2, 4 };
+    static const double alphas[] = { 1.6, 2.0, 2.5, 3.0 };
+    static const size_t tags[] = { 8, 10, 12, 14 };
+
+    for (size_t a = 0; a < sizeof(tnums) / sizeof(tnums[0]); a++)
+        for (size_t b = 0; b < sizeof(h1s) / sizeof(h1s[0]); b++)
+            for (size_t c = 0; c < sizeof(alphas) / sizeof(alphas[0]); c++)
+                for (size_t d = 0; d < sizeof(tags) / sizeof(tags[0]); d++)
+                    for (size_t log = 7; log <= 14; log++)
+                    {
+                        // 最长历史过长时折叠历史无意义, 跳过
+                        if (h1s[b] * pow(alphas[c], (double)(tnums[a] - 2)) > 2000) continue;
+
+                        char spec[128];
+                        snprintf(spec, sizeof(spec), "tage:tnum=%lu,t0=%lu,h1=%lu,alpha=%g,log=%lu,tag=%lu",
+                                 tnums[a], log + 2, h1s[b], alphas[c], log, tags[d]);
+                        BranchPredictor* bp = newPredictor(spec);
+                        UINT64 bits = bp->storageBits();
+                        delete bp;
+
+                        // 远小于预算的配置不在搜索范围内
+                        if (bits > budget_bits || bits < budget_bits / 8) continue;
+                        Candidate cand = { spec, bits, 0, 0 };
+                        out.push_back(cand);
+                    }
+}
+
+// Worker: take the next candidate and replay the conditional branches of the whole trace
+void searchWorker(BrchTraceReader* trace, std::vector<Candidate>* cands, std::atomic<size_t>* next)
+{
+    std::vector<BranchRecord> recs(trace->chunkBranches());
+    std::vector<BranchRecord> conds(trace->chunkBranches());
+    bool* preds = new bool[trace->chunkBranches()];
+
+    for (size_t k = (*next)++; k < cands->size(); k = (*next)++)
+    {
+        Candidate& cand = (*cands)[k];
+        BranchPredictor* bp = newPredictor(cand.spec);
+        for (UINT64 c = 0; c < trace->chunks(); c++)
+        {
+            UINT32 all = trace->decode(c, &recs[0]);
+            UINT32 n = 0;
+            for (UINT32 i = 0; i < all; i++)
+                if (recs[i].type == BR_COND) conds[n++] = recs[i];
+            bp->runBatch(&conds[0], n, preds);
+            for (UINT32 i = 0; i < n; i++) cand.mispreds += preds[i] != conds[i].taken;
+            cand.conds += n;
+        }
+        delete bp;
+    }
+    delete[] preds;
+}
+
+int search(double budget_kb, size_t threads, const char* path)
+{
+    BrchTraceReader trace;
+    if (!trace.open(path))
+    {
+        fprintf(stderr, "cannot read trace %s\n", path);
+        return 1;
+    }
+
+    std::vector<Candidate> cands;
+    enumerateTAGE((UINT64)(budget_kb * 8192), cands);
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    fprintf(stderr, "evaluating %lu TAGE configurations within %.1f KB on %lu threads\n",
+            cands.size(), budget_kb, threads);
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> pool;
+    for (size_t t = 0; t < threads; t++) pool.push_back(std::thread(searchWorker, &trace, &cands, &next));
+    for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+
+    // 按存储量排序, 误预测数严格小于所有更小配置的即在Pareto前沿上
+    std::sort(cands.begin(), cands.end(), cmpBits);
+    const char* unit = trace.instructions() ? "MPKI" : "MPKBr";
+    printf("Pareto front of %s vs storage (%lu candidates)\n", unit, cands.size());
+    printf("%10s %9s %14s %10s  %s\n", "bits", "KB", "mispreds", unit, "spec");
+    UINT64 best = ~0ULL;
+    for (size_t k = 0; k < cands.size(); k++)
+    {
+        if (cands[k].mispreds >= best) continue;
+        best = cands[k].mispreds;
+        printf("%10lu %9.2f %14lu %10.4f  %s\n", cands[k].bits, cands[k].bits / 8192.0, cands[k].mispreds,
+               perKilo(cands[k].mispreds, trace.instructions(), cands[k].conds), cands[k].spec.c_str());
+    }
+    if (!trace.instructions()) printf("(the trace has no instruction count, %s is per 1000 conditional branches)\n", unit);
+    return 0;
+}
+
+/* ===================================================================== */
+/* Hash function benchmark                                               */
+/* ===================================================================== */
+static const UINT32 BENCH_LOG = 12;        // 别名统计用的表项数
+static const UINT32 BENCH_HIST = 16;       // 参与哈希的全局历史长度
+
+// 表项记住上次访问它的(pc, 历史), 不同的(pc, 历史)落到同一项即为一次别名
+UINT64 countAliases(HashFn h, const std::vector<ADDRINT>& pcs, const std::vector<UINT32>& hists)
+{
+    std::vector<ADDRINT> last_pc(1 << BENCH_LOG, 0);
+    std::vector<UINT32> last_hist(1 << BENCH_LOG, 0);
+    std::vector<bool> used(1 << BENCH_LOG, false);
+    UINT64 aliases = 0;
+    for (size_t i = 0; i < pcs.size(); i++)
+    {
+        size_t idx = truncate(h(pcs[i], hists[i]), BENCH_LOG);
+        if (used[idx] && (last_pc[idx] != pcs[i] || last_hist[idx] != hists[i])) aliases++;
+        used[idx] = true;
+        last_pc[idx] = pcs[i];
+        last_hist[idx] = hists[i];
+    }
+    return aliases;
+}
+
+int hashBench(const char* path)
+{
+    BrchTraceReader trace;
+    if (!trace.open(path))
+    {
+        fprintf(stderr, "cannot read trace %s\n", path);
+        return 1;
+    }
+
+    // 取出条件分支的PC和之前BENCH_HIST条的方向
+    std::vector<BranchRecord> recs(trace.chunkBranches());
+    std::vector<ADDRINT> pcs;
+    std::vector<UINT32> hists;
+    UINT32 hist = 0;
+    for (UINT64 c = 0; c < trace.chunks(); c++)
+    {
+        UINT32 all = trace.decode(c, &recs[0]);
+        for (UINT32 i = 0; i < all; i++)
+        {
+            if (recs[i].type != BR_COND) continue;
+            pcs.push_back(recs[i].pc);
+            hists.push_back(hist);
+            hist = ((hist << 1) | recs[i].taken) & ((1u << BENCH_HIST) - 1);
+        }
+    }
+    if (pcs.empty())
+    {
+        fprintf(stderr, "no conditional branches in %s\n", path);
+        return 1;
+    }
+
+    printf("%lu conditional branches, %u-entry table indexed by pc and %u history bits\n",
+           pcs.size(), 1u << BENCH_LOG, BENCH_HIST);
+    printf("%-6s %10s %8s %16s\n", "hash", "alias%", "ns/hash", "gshare mispred%");
+    std::vector<BranchRecord> conds(trace.chunkBranches());
+    bool* preds = new bool[trace.chunkBranches()];
+    for (size_t k = 0; k < NHASH; k++)
+    {
+        UINT64 aliases = countAliases(HASH_FNS[k], pcs, hists);
+
+        // 函数指针调用包含在耗时内, 对所有哈希相同
+        timespec start, end;
+        volatile UINT128 sink = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        UINT128 acc = 0;
+        for (size_t i = 0; i < pcs.size(); i++) acc += HASH_FNS[k](pcs[i], hists[i]);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        sink = acc;
+        (void)sink;
+        double ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / pcs.size();
+
+        std::string spec = std::string("gshare:hash=") + HASH_NAMES[k];
+        BranchPredictor* bp = newPredictor(spec);
+        UINT64 mispreds = 0, total = 0;
+        for (UINT64 c = 0; c < trace.chunks(); c++)
+        {
+            UINT32 all = trace.decode(c, &recs[0]);
+            UINT32 n = 0;
+            for (UINT32 i = 0; i < all; i++)
+                if (recs[i].type == BR_COND) conds[n++] = recs[i];
+            bp->runBatch(&conds[0], n, preds);
+            for (UINT32 i = 0; i < n; i++) mispreds += preds[i] != conds[i].taken;
+            total += n;
+        }
+        delete bp;
+
+        printf("%-6s %10.4f %8.2f %16.4f\n", HASH_NAMES[k], 100.0 * aliases / pcs.size(), ns,
+               total ? 100.0 * mispreds / total : 0.0);
+    }
+    delete[] preds;
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc == 3 && strcmp(argv[1], "-hashbench") == 0) return hashBench(argv[2]);
+    if (argc >= 4 && strcmp(argv[1], "-search") == 0)
+    {
+        size_t threads = 0;
+        int arg = 3;
+        if (argc >= 6 && strcmp(argv[3], "-threads") == 0)
+        {
+            threads = strtoul(argv[4], NULL, 10);
+            arg = 5;
+        }
+        return search(strtod(argv[2], NULL), threads, argv[arg]);
+    }
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <trace> [spec ...]\n       %s -search <KB> [-threads N] <trace>\n"
+                        "       %s -hashbench <trace>\n", argv[0], argv[0], argv[0]);
+        return 1;
+    }
+
+    std::vector<const char*> specs(argv + 2, argv + argc);
+    if (specs.empty()) specs.push_back("tage:tnum=8,t0=14,h1=2,alpha=2,log=11,tag=12");
+
+    std::vector<ReplaySlot> slots;
+    for (size_t i = 0; i < specs.size(); i++)
+    {
+        ReplaySlot s = { specs[i], newPredictor(specs[i]), { 0, 0, 0, 0 }, 0 };
+        if (s.bp == NULL) return 1;
+        slots.push_back(s);
+    }
+
+    BrchTraceReader trace;
+    if (!trace.open(argv[1]))
+    {
+        fprintf(stderr, "cannot read trace %s\n", argv[1]);
+        return 1;
+    }
+
+    std::vector<BranchRecord> recs(trace.chunkBranches());
+    std::vector<BranchRecord> conds(trace.chunkBranches());      // 方向预测器只看条件分支
+    TargetModel targets(9, 4, 16, 9);                           // 与brchPredict的默认配置相同
+    bool* preds = new bool[trace.chunkBranches()];
+
+    for (UINT64 c = 0; c < trace.chunks(); c++)
+    {
+        UINT32 all = trace.decode(c, &recs[0]);
+        targets.run(&recs[0], all);
+        UINT32 n = 0;
+        for (UINT32 i = 0; i < all; i++)
+            if (recs[i].type == BR_COND) conds[n++] = recs[i];
+        for (size_t k = 0; k < slots.size(); k++)
+        {
+            ReplaySlot& s = slots[k];
+            timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            s.bp->runBatch(&conds[0], n, preds);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            s.secs += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+            for (UINT32 i = 0; i < n; i++)
+            {
+                if (preds[i])
+                {
+                    if (conds[i].taken) s.counters[0]++;
+                    else s.counters[1]++;
+                }
+                else
+                {
+                    if (conds[i].taken) s.counters[3]++;
+                    else s.counters[2]++;
+                }
+            }
+        }
+    }
+
+    printf("%-48s %14s %14s %14s %14s %10s %8s %9s %10s\n", "predictor", "takenCorrect", "takenIncorrect",
+           "notTakenCorrect", "notTakenIncorrect", "Precision", trace.instructions() ? "MPKI" : "MPKBr", "KB", "M br/s");
+    for (size_t k = 0; k < slots.size(); k++)
+    {
+        const UINT64* c = slots[k].counters;
+        UINT64 total = c[0] + c[1] + c[2] + c[3];
+        printf("%-48s %14lu %14lu %14lu %14lu %10.4f %8.4f %9.2f %10.1f\n", slots[k].spec, c[0], c[1], c[2], c[3],
+               total ? 100.0 * (c[0] + c[2]) / total : 0.0, perKilo(c[1] + c[3], trace.instructions(), total),
+               slots[k].bp->storageBits() / 8192.0, slots[k].secs > 0 ? total / slots[k].secs / 1e6 : 0.0);
+    }
+    if (trace.instructions()) printf("%s\n", targets.report(trace.instructions()).c_str());
+    else printf("%s (the trace has no instruction count, MPKI is not available)\n", targets.report(0).c_str());
+    for (size_t k = 0; k < slots.size(); k++)
+    {
+        std::string extra = slots[k].bp->report();
+        if (!extra.empty()) printf("%s\n%s\n", slots[k].spec, extra.c_str());
+        delete slots[k].bp;
+    }
+
+    delete[] preds;
+    return 0;
+}
@@ -0,0 +1,451 @@
+/**************************************
+ * Branch target prediction of brchPredict and brchReplay
+ *
+ * BTB:     组相联, LRU替换, 预测直接跳转/调用和taken条件分支的目标
+ * RAS:     返回地址栈, 满时覆盖最旧的项 (overflow), 空时无法预测 (underflow)
+ * ITTAGE:  间接跳转/调用的目标预测, 未命中带tag的表时使用BTB的目标
+ * 目标预测错误与方向预测错误分开统计, 条件分支只在taken时计入目标预测
+**************************************/
+#ifndef BRCH_TARGET_H
+#define BRCH_TARGET_H
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "brchPredictor.h"
+
+class BTB
+{
+    struct Entry
+    {
+        ADDRINT pc;             // 0为无效
+        ADDRINT target;
+        UINT64 stamp;           // LRU
+    };
+
+    const size_t m_sets_log;
+    const size_t m_ways;
+    Entry* m_entries;
+    UINT64 m_clock;
+
+    Entry* findSet(ADDRINT pc) { return &m_entries[truncate(pc ^ (pc >> m_sets_log), m_sets_log) * m_ways]; }
+
+    public:
+        BTB(size_t sets_log, size_t ways) : m_sets_log(sets_log), m_ways(ways), m_clock(0)
+        {
+            m_entries = new Entry[m_ways << m_sets_log];
+            memset(m_entries, 0, sizeof(Entry) * (m_ways << m_sets_log));
+        }
+
+        ~BTB() { delete[] m_entries; }
+
+        // Return true on a hit and write the stored target
+        bool lookup(ADDRINT pc, ADDRINT& target)
+        {
+            Entry* set = findSet(pc);
+            for (size_t i = 0; i < m_ways; i++)
+            {
+                if (set[i].pc != pc) continue;
+                target = set[i].target;
+                set[i].stamp = ++m_clock;
+                return true;
+            }
+            return false;
+        }
+
+        void update(ADDRINT pc, ADDRINT target)
+        {
+            Entry* set = findSet(pc);
+            Entry* victim = &set[0];
+            for (size_t i = 0; i < m_ways; i++)
+            {
+                if (set[i].pc == pc) { victim = &set[i]; break; }
+                if (set[i].stamp < victim->stamp) victim = &set[i];
+            }
+            victim->pc = pc;
+            victim->target = target;
+            victim->stamp = ++m_clock;
+        }
+
+        void save(CkptWriter& w) { w.put(m_clock); w.putArray(m_entries, m_ways << m_sets_log); }
+        void load(CkptReader& r) { r.get(m_clock); r.getArray(m_entries, m_ways << m_sets_log); }
+};
+
+class RAS
+{
+    const size_t m_depth;
+    ADDRINT* m_stack;           // 循环缓冲区
+    size_t m_top;               // 下一次push的位置
+    size_t m_count;
+
+    public:
+        UINT64 overflows;
+        UINT64 underflows;
+
+        RAS(size_t depth) : m_depth(depth), m_top(0), m_count(0), overflows(0), underflows(0)
+        {
+            m_stack = new ADDRINT[m_depth];
+            memset(m_stack, 0, sizeof(ADDRINT) * m_depth);
+        }
+
+        ~RAS() { delete[] m_stack; }
+
+        void push(ADDRINT ret)
+        {
+            if (m_count == m_depth) overflows++;
+            else m_count++;
+            m_stack[m_top] = ret;
+            m_top = (m_top + 1) % m_depth;
+        }
+
+        // Return false if the stack is empty
+        bool pop(ADDRINT& ret)
+        {
+            if (m_count == 0)
+            {
+                underflows++;
+                return false;
+            }
+            m_top = (m_top + m_depth - 1) % m_depth;
+            m_count--;
+            ret = m_stack[m_top];
+            return true;
+        }
+
+        void save(CkptWriter& w) { w.put(m_top); w.put(m_count); w.putArray(m_stack, m_depth); }
+        void load(CkptReader& r) { r.get(m_top); r.get(m_count); r.getArray(m_stack, m_depth); }
+};
+
+// Indirect target TAGE: 带tag的表按几何级数的历史长度索引, 每项保存一个目标和2位置信度
+class ITTAGE
+{
+    static const UINT32 TAG_BITS = 11;
+    static const UINT8 CTR_MAX = 3;
+    static const UINT32 RESET_PERIOD = 1 << 18;
+    static const size_t PATH_BITS = 3;          // 每条间接分支移入历史的路径位数
+
+    struct Entry
+    {
+        ADDRINT target;
+        UINT16 tag;
+        UINT8 ctr;
+        UINT8 u;
+    };
+
+    const size_t m_tnum;                // 带tag的表个数, T[1 : m_tnum]
+    const size_t m_entries_log;
+    Entry* m_entries;                   // T[i]从(i - 1) << m_entries_log开始
+    size_t* m_hist_len;
+    ShiftReg* m_ghr;
+    FoldedHistory* m_idx_fold;
+    FoldedHistory* m_tag_fold;
+    UINT32 m_updates;
+
+    // predict时计算, update时复用
+    UINT32* m_idx;
+    UINT16* m_tag;
+    size_t m_provider;                  // 0为未命中, 使用BTB
+    size_t m_alt;
+
+    void shift(bool b)
+    {
+        m_ghr->shiftIn(b);
+        for (size_t i = 1; i <= m_tnum; i++)
+        {
+            bool out = m_ghr->bit(m_hist_len[i]);
+            m_idx_fold[i].update(b, out);
+            m_tag_fold[i].update(b, out);
+        }
+    }
+
+    public:
+        // param:   tnum:           带tag的表个数
+        //          entry_num_log:  每张表行数的对数
+        //          hist_min:       T[1]的历史长度, 之后每张表翻倍
+        ITTAGE(size_t tnum, size_t entry_num_log, size_t hist_min)
+        : m_tnum(tnum), m_entries_log(entry_num_log), m_updates(0), m_provider(0), m_alt(0)
+        {
+            m_entries = new Entry[m_tnum << m_entries_log];
+            memset(m_entries, 0, sizeof(Entry) * (m_tnum << m_entries_log));
+            m_hist_len = new size_t[m_tnum + 1];
+            m_idx_fold = new FoldedHistory[m_tnum + 1];
+            m_tag_fold = new FoldedHistory[m_tnum + 1];
+            m_idx = new UINT32[m_tnum + 1];
+            m_tag = new UINT16[m_tnum + 1];
+
+            m_hist_len[0] = 0;
+            for (size_t i = 1; i <= m_tnum; i++)
+            {
+                m_hist_len[i] = hist_min << (i - 1);
+                m_idx_fold[i].init(m_hist_len[i], m_entries_log);
+                m_tag_fold[i].init(m_hist_len[i], TAG_BITS);
+            }
+            m_ghr = new ShiftReg(m_hist_len[m_tnum]);
+        }
+
+        ~ITTAGE()
+        {
+            delete[] m_entries;
+            delete[] m_hist_len;
+            delete[] m_idx_fold;
+            delete[] m_tag_fold;
+            delete[] m_idx;
+            delete[] m_tag;
+            delete m_ghr;
+        }
+
+        // Return true if a tagged table provides a target
+        bool predict(ADDRINT pc, ADDRINT& target)
+        {
+            ADDRINT h = pc ^ (pc >> m_entries_log);
+            m_provider = m_alt = 0;
+            for (size_t i = m_tnum; i >= 1; i--)
+            {
+                m_idx[i] = ((i - 1) << m_entries_log) + (UINT32)truncate(h ^ m_idx_fold[i].getVal(), m_entries_log);
+                m_tag[i] = truncate((pc >> 2) ^ m_tag_fold[i].getVal(), TAG_BITS);
+                const Entry& e = m_entries[m_idx[i]];
+                if (e.tag != m_tag[i] || e.target == 0) continue;      // target为0的项未分配过
+                if (m_provider == 0) m_provider = i;
+                else if (m_alt == 0) m_alt = i;
+            }
+            if (m_provider == 0) return false;
+
+            // 新分配的项置信度低时用次长的匹配
+            const Entry& e = m_entries[m_idx[m_provider]];
+            target = e.ctr == 0 && m_alt ? m_entries[m_idx[m_alt]].target : e.target;
+            return true;
+        }
+
+        // param:   predicted:  最终预测的目标 (含BTB的), 0为没有预测
+        void update(ADDRINT pc, ADDRINT target, ADDRINT predicted)
+        {
+            bool correct = predicted == target;
+            if (m_provider)
+            {
+                Entry& e = m_entries[m_idx[m_provider]];
+                if (e.target == target)
+                {
+                    if (e.ctr < CTR_MAX) e.ctr++;
+                    if (m_alt && m_entries[m_idx[m_alt]].target != target && e.u < 3) e.u++;
+                }
+                else if (e.ctr > 0) e.ctr--;
+                else e.target = target;
+            }
+
+            // 预测错误时在更长的表中分配
+            if (!correct && m_provider < m_tnum)
+            {
+                bool allocated = false;
+                for (size_t i = m_provider + 1; i <= m_tnum; i++)
+                {
+                    Entry& e = m_entries[m_idx[i]];
+                    if (e.u != 0) continue;
+                    e.target = target;
+                    e.tag = m_tag[i];
+                    e.ctr = 0;
+                    allocated = true;
+                    break;
+                }
+                if (!allocated)
+                    for (size_t i = m_provider + 1; i <= m_tnum; i++)
+                        if (m_entries[m_idx[i]].u) m_entries[m_idx[i]].u--;
+            }
+
+            if (++m_updates == RESET_PERIOD)
+            {
+                m_updates = 0;
+                for (size_t j = 0; j < (m_tnum << m_entries_log); j++) m_entries[j].u >>= 1;
+            }
+        }
+
+        // 条件分支移入方向, 间接分支移入PATH_BITS位路径信息, 使历史包含调用路径.
+        // 函数入口通常按16字节对齐, 目标的低4位几乎都是0, 因此取(target >> 4) ^ pc,
+        // 再按PATH_BITS位一段异或折叠, 使每一位地址都落在移入的PATH_BITS位之内
+        void updateHistory(const BranchRecord& r)
+        {
+            if (r.type == BR_COND)
+            {
+                shift(r.taken);
+            }
+            else if (r.type == BR_INDIRECT || r.type == BR_ICALL)
+            {
+                UINT64 path = (r.target >> 4) ^ r.pc;
+                UINT64 fold = 0;
+                for (; path; path >>= PATH_BITS) fold ^= path & ((1 << PATH_BITS) - 1);
+                path = fold;
+                for (size_t i = 0; i < PATH_BITS; i++) shift((path >> i) & 1);
+            }
+        }
+
+        void save(CkptWriter& w)
+        {
+            w.put(m_updates);
+            w.putArray(m_entries, m_tnum << m_entries_log);
+            m_ghr->save(w);
+            for (size_t i = 1; i <= m_tnum; i++)
+            {
+                w.put(m_idx_fold[i].getVal());
+                w.put(m_tag_fold[i].getVal());
+            }
+        }
+
+        void load(CkptReader& r)
+        {
+            r.get(m_updates);
+            r.getArray(m_entries, m_tnum << m_entries_log);
+            m_ghr->load(r);
+            for (size_t i = 1; i <= m_tnum; i++)
+            {
+                UINT32 fold[2] = { 0 };
+                r.getArray(fold, 2);
+                m_idx_fold[i].setVal(fold[0]);
+                m_tag_fold[i].setVal(fold[1]);
+            }
+        }
+};
+
+// BTB + RAS + ITTAGE, driven by every control-flow record
+class TargetModel
+{
+    enum { STAT_BRANCHES, STAT_MISPRED, STAT_BTB_MISS, NSTATS };
+
+    BTB m_btb;
+    RAS m_ras;
+    ITTAGE* m_ittage;                   // NULL为只用BTB预测间接分支
+    UINT64 m_stats[BR_NTYPES][NSTATS];
+    double m_acc[BR_NTYPES][NSTATS + 2];    // SimPoint加权累加, 最后两项为RAS overflow/underflow
+
+    public:
+        // param:   btb_sets_log, btb_ways: BTB的组数的对数和相联度
+        //          ras_depth:              RAS的项数
+        //          ittage_log:             ITTAGE每张表行数的对数, 0为不使用
+        TargetModel(size_t btb_sets_log, size_t btb_ways, size_t ras_depth, size_t ittage_log)
+        : m_btb(btb_sets_log, btb_ways), m_ras(ras_depth),
+          m_ittage(ittage_log ? new ITTAGE(6, ittage_log, 4) : NULL)
+        {
+            memset(m_stats, 0, sizeof(m_stats));
+            memset(m_acc, 0, sizeof(m_acc));
+        }
+
+        ~TargetModel() { delete m_ittage; }
+
+        void run(const BranchRecord* recs, UINT64 n)
+        {
+            for (UINT64 i = 0; i < n; i++) access(recs[i]);
+        }
+
+        void access(const BranchRecord& r)
+        {
+            // 不taken的条件分支不需要目标
+            if (r.type == BR_COND && !r.taken)
+            {
+                if (m_ittage) m_ittage->updateHistory(r);
+                return;
+            }
+
+            UINT64* st = m_stats[r.type];
+            st[STAT_BRANCHES]++;
+
+            ADDRINT predicted = 0;
+            bool btb_hit = m_btb.lookup(r.pc, predicted);
+            switch (r.type)
+            {
+                case BR_COND:
+                case BR_JUMP:
+                case BR_CALL:
+                    if (!btb_hit) st[STAT_BTB_MISS]++;
+                    if (predicted != r.target) st[STAT_MISPRED]++;
+                    m_btb.update(r.pc, r.target);
+                    break;
+                case BR_INDIRECT:
+                case BR_ICALL:
+                {
+                    if (!btb_hit) st[STAT_BTB_MISS]++;
+                    ADDRINT it;
+                    if (m_ittage && m_ittage->predict(r.pc, it)) predicted = it;
+                    if (predicted != r.target) st[STAT_MISPRED]++;
+                    if (m_ittage) m_ittage->update(r.pc, r.target, predicted);
+                    m_btb.update(r.pc, r.target);
+                    break;
+                }
+                case BR_RET:
+                    if (!m_ras.pop(predicted) || predicted != r.target) st[STAT_MISPRED]++;
+                    break;
+                default:
+                    break;
+            }
+            if (r.type == BR_CALL || r.type == BR_ICALL) m_ras.push(r.pc + r.size);
+            if (m_ittage) m_ittage->updateHistory(r);
+        }
+
+        void resetStats()
+        {
+            memset(m_stats, 0, sizeof(m_stats));
+            m_ras.overflows = m_ras.underflows = 0;
+        }
+
+        void accumulate(double weight)
+        {
+            for (int t = 0; t < BR_NTYPES; t++)
+                for (int j = 0; j < NSTATS; j++) m_acc[t][j] += weight * m_stats[t][j];
+            m_acc[0][NSTATS] += weight * m_ras.overflows;
+            m_acc[0][NSTATS + 1] += weight * m_ras.underflows;
+        }
+
+        void useAccumulated()
+        {
+            for (int t = 0; t < BR_NTYPES; t++)
+                for (int j = 0; j < NSTATS; j++) m_stats[t][j] = (UINT64)(m_acc[t][j] + 0.5);
+            m_ras.overflows = (UINT64)(m_acc[0][NSTATS] + 0.5);
+            m_ras.underflows = (UINT64)(m_acc[0][NSTATS + 1] + 0.5);
+        }
+
+        // Return the target table, one line per branch type; instructions is used for MPKI
+        std::string report(double instructions)
+        {
+            static const char* names[BR_NTYPES] = { "cond (taken)", "jump", "indirect", "call", "icall", "ret" };
+            std::string out;
+            char line[256];
+            snprintf(line, sizeof(line), "%-16s %14s %14s %14s %10s\n", "target", "branches", "btbMiss", "targetMispred", "MPKI");
+            out += line;
+            UINT64 total = 0;
+            for (int t = 0; t < BR_NTYPES; t++)
+            {
+                const UINT64* st = m_stats[t];
+                total += st[STAT_MISPRED];
+                snprintf(line, sizeof(line), "%-16s %14lu %14lu %14lu %10.4f\n", names[t], st[STAT_BRANCHES],
+                         st[STAT_BTB_MISS], st[STAT_MISPRED], instructions > 0 ? 1000 * st[STAT_MISPRED] / instructions : 0);
+                out += line;
+            }
+            snprintf(line, sizeof(line), "%-16s %14s %14s %14lu %10.4f\n", "all", "", "", total,
+                     instructions > 0 ? 1000 * total / instructions : 0);
+            out += line;
+            snprintf(line, sizeof(line), "RAS overflows: %lu, underflows: %lu", m_ras.overflows, m_ras.underflows);
+            out += line;
+            return out;
+        }
+
+        void save(CkptWriter& w)
+        {
+            w.putArray(&m_stats[0][0], BR_NTYPES * NSTATS);
+            w.putArray(&m_acc[0][0], BR_NTYPES * (NSTATS + 2));
+            w.put(m_ras.overflows);
+            w.put(m_ras.underflows);
+            m_btb.save(w);
+            m_ras.save(w);
+            if (m_ittage) m_ittage->save(w);
+        }
+
+        void load(CkptReader& r)
+        {
+            r.getArray(&m_stats[0][0], BR_NTYPES * NSTATS);
+            r.getArray(&m_acc[0][0], BR_NTYPES * (NSTATS + 2));
+            r.get(m_ras.overflows);
+            r.get(m_ras.underflows);
+            m_btb.load(r);
+            m_ras.load(r);
+            if (m_ittage) m_ittage->load(r);
+        }
+};
+
+#endif
@@ -0,0 +1,221 @@
+/**************************************
+ * Branch trace written by brchPredict (-trace) and replayed by brchReplay
+ *
+ * 文件: Header | chunk 0 | chunk 1 | ... | 索引 (每个chunk一个TraceChunk)
+ * chunk内每条分支:
+ *   标志字节 (bit 0-2 分支类型, bit 3 taken, bit 4-7 指令长度)
+ *   PC相对上一条分支PC的差值 (zigzag varint)
+ *   目标相对PC的差值 (zigzag varint)
+ * 每个chunk从PC = 0开始编码, 可以单独解码
+**************************************/
+#ifndef BRCH_TRACE_H
+#define BRCH_TRACE_H
+
+#include <cstdio>
+#include <vector>
+#ifdef BRCH_STANDALONE
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "brchPredictor.h"         // 在unistd.h之后, 其truncate宏与truncate()同名
+
+static const UINT64 TRACE_MAGIC = 0x3145434152544252ULL;     // "RBTRACE1"
+static const UINT32 TRACE_VERSION = 3;
+static const UINT32 TRACE_CHUNK_BRANCHES = 1 << 16;
+static const UINT32 TRACE_MAX_CHUNK_BRANCHES = 1 << 24;     // 读取时的上限, 防止损坏的头部使缓冲区过大
+
+struct TraceHeader
+{
+    UINT64 magic;
+    UINT32 version;
+    UINT32 chunk_branches;      // 每个chunk最多的分支数
+    UINT64 branches;
+    UINT64 chunks;
+    UINT64 index_offset;        // 索引在文件中的位置
+    UINT64 instructions;        // 记录期间执行的指令数, 0为未知
+};
+
+struct TraceChunk
+{
+    UINT64 offset;
+    UINT64 first;               // chunk中第一条分支的序号
+    UINT32 count;
+    UINT32 bytes;
+};
+
+class BrchTraceWriter
+{
+public:
+    BrchTraceWriter() : m_f(NULL), m_count(0), m_last_pc(0), m_branches(0), m_offset(0) {}
+
+    bool open(const char* path)
+    {
+        m_f = fopen(path, "wb");
+        if (m_f == NULL) return false;
+        TraceHeader h = { 0, 0, 0, 0, 0, 0, 0 };    // 关闭时重写
+        fwrite(&h, sizeof(h), 1, m_f);
+        m_offset = sizeof(h);
+        return true;
+    }
+
+    bool isOpen() { return m_f != NULL; }
+
+    void append(const BranchRecord* recs, UINT64 n)
+    {
+        if (m_f == NULL) return;
+        for (UINT64 i = 0; i < n; i++)
+        {
+            m_buf.push_back((UINT8)((recs[i].type & 7) | (recs[i].taken ? 8 : 0) | ((recs[i].size & 15) << 4)));
+            putVarint(recs[i].pc - m_last_pc);
+            putVarint(recs[i].target - recs[i].pc);
+            m_last_pc = recs[i].pc;
+            if (++m_count == TRACE_CHUNK_BRANCHES) flush();
+        }
+    }
+
+    // Write the last chunk, the index and the header
+    void close(UINT64 instructions = 0)
+    {
+        if (m_f == NULL) return;
+        flush();
+        TraceHeader h = { TRACE_MAGIC, TRACE_VERSION, TRACE_CHUNK_BRANCHES, m_branches, m_index.size(), m_offset, instructions };
+        if (!m_index.empty()) fwrite(&m_index[0], sizeof(TraceChunk), m_index.size(), m_f);
+        fseek(m_f, 0, SEEK_SET);
+        fwrite(&h, sizeof(h), 1, m_f);
+        fclose(m_f);
+        m_f = NULL;
+    }
+
+private:
+    FILE* m_f;
+    std::vector<UINT8> m_buf;           // 当前chunk
+    std::vector<TraceChunk> m_index;
+    UINT32 m_count;                     // 当前chunk的分支数
+    ADDRINT m_last_pc;
+    UINT64 m_branches;
+    UINT64 m_offset;                    // 当前chunk在文件中的位置
+
+    void putVarint(ADDRINT delta)
+    {
+        UINT64 v = (delta << 1) ^ (UINT64)((INT64)delta >> 63);    // zigzag
+        while (v >= 0x80)
+        {
+            m_buf.push_back((UINT8)(v | 0x80));
+            v >>= 7;
+        }
+        m_buf.push_back((UINT8)v);
+    }
+
+    void flush()
+    {
+        if (m_count == 0) return;
+        TraceChunk c = { m_offset, m_branches, m_count, (UINT32)m_buf.size() };
+        fwrite(&m_buf[0], 1, m_buf.size(), m_f);
+        m_index.push_back(c);
+        m_offset += m_buf.size();
+        m_branches += m_count;
+        m_buf.clear();
+        m_count = 0;
+        m_last_pc = 0;
+    }
+};
+
+#ifdef BRCH_STANDALONE
+// Memory-mapped reader, only built into brchReplay
+class BrchTraceReader
+{
+public:
+    BrchTraceReader() : m_data(NULL), m_size(0), m_header(NULL), m_index(NULL) {}
+    ~BrchTraceReader() { if (m_data) munmap((void*)m_data, m_size); }
+
+    bool open(const char* path)
+    {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(TraceHeader))
+        {
+            m_size = st.st_size;
+            void* p = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) m_data = (const UINT8*)p;
+        }
+        ::close(fd);
+        if (m_data == NULL) return false;
+
+        m_header = (const TraceHeader*)m_data;
+        if (m_header->magic != TRACE_MAGIC || m_header->version != TRACE_VERSION
+            || m_header->chunk_branches == 0 || m_header->chunk_branches > TRACE_MAX_CHUNK_BRANCHES
+            || m_header->index_offset > m_size
+            || m_header->chunks > (m_size - m_header->index_offset) / sizeof(TraceChunk))
+            return false;
+        m_index = (const TraceChunk*)(m_data + m_header->index_offset);
+
+        // 损坏的索引会让decode越过映射或写出out, 逐个检查
+        for (UINT64 i = 0; i < m_header->chunks; i++)
+        {
+            const TraceChunk& c = m_index[i];
+            if (c.offset < sizeof(TraceHeader) || c.offset >= m_size || c.bytes > m_size - c.offset
+                || c.count > m_header->chunk_branches)
+                return false;
+        }
+        madvise((void*)m_data, m_size, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    UINT64 branches() { return m_header->branches; }
+    UINT64 chunks() { return m_header->chunks; }
+    UINT32 chunkBranches() { return m_header->chunk_branches; }
+    UINT64 instructions() { return m_header->instructions; }
+
+    // Decode chunk i into out, which holds at least chunkBranches() records; return the number of records
+    UINT32 decode(UINT64 i, BranchRecord* out)
+    {
+        const TraceChunk& c = m_index[i];
+        const UINT8* p = m_data + c.offset;
+        const UINT8* end = p + c.bytes;
+        ADDRINT pc = 0;
+        for (UINT32 k = 0; k < c.count; k++)
+        {
+            // 截断的chunk只返回完整解码的记录
+            ADDRINT dpc, dtarget;
+            if (p == end) return k;
+            UINT8 flags = *p++;
+            if (!getVarint(p, end, dpc) || !getVarint(p, end, dtarget)) return k;
+            pc += dpc;
+            out[k].pc = pc;
+            out[k].target = pc + dtarget;
+            out[k].type = flags & 7;
+            out[k].size = flags >> 4;
+            out[k].taken = (flags & 8) != 0;
+        }
+        return c.count;
+    }
+
+private:
+    const UINT8* m_data;
+    size_t m_size;
+    const TraceHeader* m_header;
+    const TraceChunk* m_index;
+
+    // Decode one varint without reading at or past end; false if the chunk ends inside it or it is too long
+    static bool getVarint(const UINT8*& p, const UINT8* end, ADDRINT& out)
+    {
+        UINT64 v = 0;
+        int shift = 0;
+        while (p < end && (*p & 0x80))
+        {
+            if (shift > 56) return false;
+            v |= (UINT64)(*p++ & 0x7f) << shift;
+            shift += 7;
+        }
+        if (p == end) return false;
+        v |= (UINT64)(*p++) << shift;
+        out = (v >> 1) ^ (~(v & 1) + 1);      // zigzag
+        return true;
+    }
+};
+#endif
+
+#endif
@@ -2,7 +2,15 @@
 #include <cmath>
 #include <cstring>
 #include <ctime>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
 #include "pin.H"
+#include "phaseCtrl.h"
+#include "checkpoint.h"
 
 typedef unsigned int        UINT32;
 typedef unsigned long int   UINT64;
@@ -34,6 +42,330 @@ UINT32 get_phy_addr(UINT32 virtual_addr)
     return (get_phy_page_no(get_vir_page_no(virtual_addr)) << PAGE_SIZE_LOG) + get_page_offset(virtual_addr);
 }
 
+/**************************************
+ * DRAM Timing Model
+ * 挂在cache之后, 接收miss和写回请求
+ * 时间单位为DRAM时钟周期
+**************************************/
+struct DramTiming
+{
+    UINT32 tCL;             // CAS latency: 行已打开时的列访问延迟
+    UINT32 tRCD;            // 激活一行所需的延迟
+    UINT32 tRP;             // 预充电(关闭一行)所需的延迟
+    UINT32 tBURST;          // 一个cache行在数据总线上的传输时间
+};
+
+class DramModel
+{
+public:
+    enum RowPolicy { OPEN_PAGE, CLOSED_PAGE };
+
+    // 地址映射方式, 从高位到低位排列
+    enum AddrMap
+    {
+        MAP_RO_BA_RA_CO_CH,     // row : bank : rank : column : channel
+        MAP_RO_RA_BA_CH_CO,     // row : rank : bank : channel : column
+        MAP_PERMUTE             // 同MAP_RO_BA_RA_CO_CH, bank号与row低位异或 (permutation-based interleaving)
+    };
+
+    // Constructor
+    // param:   log_channels/log_ranks/log_banks:   通道数/每通道rank数/每rank bank数的对数
+    //          log_row_size:                       行缓冲大小(字节)的对数
+    //          log_line_size:                      请求粒度(cache块大小)的对数
+    //          queue_depth:                        每个通道的请求队列深度
+    DramModel(UINT32 log_channels, UINT32 log_ranks, UINT32 log_banks, UINT32 log_row_size, UINT32 log_line_size,
+              RowPolicy policy, AddrMap map, UINT32 queue_depth, const DramTiming& timing)
+        : m_ch_log(log_channels), m_ra_log(log_ranks), m_ba_log(log_banks),
+          m_co_log(log_row_size > log_line_size ? log_row_size - log_line_size : 0), m_line_log(log_line_size),
+          m_policy(policy), m_map(map), m_qdepth(queue_depth ? queue_depth : 1), m_t(timing), m_now(0),
+          m_reads(0), m_writes(0), m_row_hits(0), m_row_empty(0), m_row_conflicts(0),
+          m_rd_latency(0), m_wr_latency(0), m_max_rd_latency(0), m_acc_max_rd_latency(0)
+    {
+        memset(m_acc, 0, sizeof(m_acc));
+        UINT32 banks = 1u << (m_ch_log + m_ra_log + m_ba_log);
+        m_open_row = new INT64[banks];
+        m_bank_ready = new UINT64[banks];
+        for (UINT32 i = 0; i < banks; i++)
+        {
+            m_open_row[i] = NO_ROW;
+            m_bank_ready[i] = 0;
+        }
+
+        m_queue = new std::deque<Request>[1u << m_ch_log];
+        m_bus_free = new UINT64[1u << m_ch_log];
+        memset(m_bus_free, 0, sizeof(UINT64) << m_ch_log);
+    }
+
+    // Destructor
+    ~DramModel()
+    {
+        delete[] m_open_row;
+        delete[] m_bank_ready;
+        delete[] m_queue;
+        delete[] m_bus_free;
+    }
+
+    // Advance the memory clock
+    void advance(UINT32 cycles) { m_now += cycles; }
+
+    // Enqueue a line fill (read) or a writeback (write) arriving at the current time
+    void request(UINT32 line_addr, bool is_write)
+    {
+        Request req;
+        decode(line_addr, req);
+        req.arrival = m_now;
+        req.is_write = is_write;
+
+        std::deque<Request>& q = m_queue[req.channel];
+        schedule(req.channel, m_now);
+        if (q.size() >= m_qdepth) issue(req.channel);     // 队列已满, 强制发射一个请求
+        q.push_back(req);
+    }
+
+    // Clear the statistics but keep the bank and queue state
+    void resetStats()
+    {
+        m_reads = m_writes = 0;
+        m_row_hits = m_row_empty = m_row_conflicts = 0;
+        m_rd_latency = m_wr_latency = m_max_rd_latency = 0;
+    }
+
+    // Add the statistics of this window, scaled by weight, to the accumulated totals
+    void accumulate(double weight)
+    {
+        drainAll();
+        UINT64 stats[NSTATS] = { m_reads, m_writes, m_row_hits, m_row_empty, m_row_conflicts, m_rd_latency, m_wr_latency };
+        for (int i = 0; i < NSTATS; i++) m_acc[i] += weight * stats[i];
+        if (m_max_rd_latency > m_acc_max_rd_latency) m_acc_max_rd_latency = m_max_rd_latency;
+    }
+
+    // Replace the statistics with the accumulated totals before dumping
+    void useAccumulated()
+    {
+        UINT64* stats[NSTATS] = { &m_reads, &m_writes, &m_row_hits, &m_row_empty, &m_row_conflicts, &m_rd_latency, &m_wr_latency };
+        for (int i = 0; i < NSTATS; i++) *stats[i] = (UINT64)(m_acc[i] + 0.5);
+        m_max_rd_latency = m_acc_max_rd_latency;
+    }
+
+    // Write bank, queue and statistics state to a checkpoint
+    void save(CkptWriter& w)
+    {
+        UINT32 banks = 1u << (m_ch_log + m_ra_log + m_ba_log);
+        w.put(m_now);
+        w.putArray(m_open_row, banks);
+        w.putArray(m_bank_ready, banks);
+        w.putArray(m_bus_free, 1u << m_ch_log);
+        for (UINT32 ch = 0; ch < (1u << m_ch_log); ch++)
+        {
+            w.put((UINT32)m_queue[ch].size());
+            for (UINT32 i = 0; i < m_queue[ch].size(); i++) w.put(m_queue[ch][i]);
+        }
+
+        UINT64 stats[NSTATS] = { m_reads, m_writes, m_row_hits, m_row_empty, m_row_conflicts, m_rd_latency, m_wr_latency };
+        w.putArray(stats, NSTATS);
+        w.put(m_max_rd_latency);
+        w.putArray(m_acc, NSTATS);
+        w.put(m_acc_max_rd_latency);
+    }
+
+    void load(CkptReader& r)
+    {
+        UINT32 banks = 1u << (m_ch_log + m_ra_log + m_ba_log);
+        r.get(m_now);
+        r.getArray(m_open_row, banks);
+        r.getArray(m_bank_ready, banks);
+        r.getArray(m_bus_free, 1u << m_ch_log);
+        for (UINT32 ch = 0; ch < (1u << m_ch_log); ch++)
+        {
+            UINT32 n = 0;
+            r.get(n);
+            m_queue[ch].clear();
+            for (UINT32 i = 0; i < n && r.ok(); i++)
+            {
+                Request req;
+                r.get(req);
+                m_queue[ch].push_back(req);
+            }
+        }
+
+        UINT64 stats[NSTATS];
+        r.getArray(stats, NSTATS);
+        m_reads = stats[0];
+        m_writes = stats[1];
+        m_row_hits = stats[2];
+        m_row_empty = stats[3];
+        m_row_conflicts = stats[4];
+        m_rd_latency = stats[5];
+        m_wr_latency = stats[6];
+        r.get(m_max_rd_latency);
+        r.getArray(m_acc, NSTATS);
+        r.get(m_acc_max_rd_latency);
+    }
+
+    // Issue everything still pending, e.g. before dumping results
+    void drainAll()
+    {
+        for (UINT32 ch = 0; ch < (1u << m_ch_log); ch++)
+            while (!m_queue[ch].empty()) issue(ch);
+    }
+
+    void dumpResults()
+    {
+        drainAll();
+
+        UINT64 accesses = m_reads + m_writes;
+        float rowHitRate = accesses ? 100 * (float)m_row_hits / accesses : 0;
+        float avgRdLat = m_reads ? (float)m_rd_latency / m_reads : 0;
+        float avgWrLat = m_writes ? (float)m_wr_latency / m_writes : 0;
+        printf("\tDRAM reads: %lu,\twritebacks: %lu\n", m_reads, m_writes);
+        printf("\trow hits: %lu,\trow empty: %lu,\tbank conflicts: %lu,\trow-buffer hit rate: %.2f%%\n",
+               m_row_hits, m_row_empty, m_row_conflicts, rowHitRate);
+        printf("\tavg miss latency: %.2f cycles,\tmax miss latency: %lu cycles,\tavg writeback latency: %.2f cycles\n",
+               avgRdLat, m_max_rd_latency, avgWrLat);
+    }
+
+private:
+    static const INT64 NO_ROW = -1;
+
+    struct Request
+    {
+        UINT32 channel;
+        UINT32 bank;        // 全局bank号: (channel, rank, bank)
+        INT64 row;
+        UINT64 arrival;
+        bool is_write;
+    };
+
+    UINT32 m_ch_log;
+    UINT32 m_ra_log;
+    UINT32 m_ba_log;
+    UINT32 m_co_log;        // 每行包含的cache行数的对数
+    UINT32 m_line_log;
+    RowPolicy m_policy;
+    AddrMap m_map;
+    UINT32 m_qdepth;
+    DramTiming m_t;
+
+    UINT64 m_now;           // 当前时间
+    INT64* m_open_row;      // 各bank当前打开的行
+    UINT64* m_bank_ready;   // 各bank可以接收下一条命令的时间
+    UINT64* m_bus_free;     // 各通道数据总线空闲的时间
+    std::deque<Request>* m_queue;   // 各通道的请求队列, 按到达顺序排列
+
+    UINT64 m_reads;
+    UINT64 m_writes;
+    UINT64 m_row_hits;
+    UINT64 m_row_empty;
+    UINT64 m_row_conflicts;
+    UINT64 m_rd_latency;    // 所有读请求的延迟之和
+    UINT64 m_wr_latency;
+    UINT64 m_max_rd_latency;
+
+    static const int NSTATS = 7;
+    double m_acc[NSTATS];   // SimPoint加权累加的统计结果
+    UINT64 m_acc_max_rd_latency;
+
+    // Split a line address into channel, bank and row according to m_map
+    void decode(UINT32 line_addr, Request& req)
+    {
+        UINT64 a = line_addr >> m_line_log;
+        UINT32 ch, ra, ba;
+        if (m_map == MAP_RO_RA_BA_CH_CO)
+        {
+            a >>= m_co_log;
+            ch = a & ((1u << m_ch_log) - 1);    a >>= m_ch_log;
+            ba = a & ((1u << m_ba_log) - 1);    a >>= m_ba_log;
+            ra = a & ((1u << m_ra_log) - 1);    a >>= m_ra_log;
+        }
+        else
+        {
+            ch = a & ((1u << m_ch_log) - 1);    a >>= m_ch_log;
+            a >>= m_co_log;
+            ra = a & ((1u << m_ra_log) - 1);    a >>= m_ra_log;
+            ba = a & ((1u << m_ba_log) - 1);    a >>= m_ba_log;
+            if (m_map == MAP_PERMUTE) ba ^= a & ((1u << m_ba_log) - 1);
+        }
+        req.channel = ch;
+        req.bank = (((ch << m_ra_log) | ra) << m_ba_log) | ba;
+        req.row = (INT64)a;
+    }
+
+    // Issue requests of a channel whose controller became free before 'until'
+    void schedule(UINT32 ch, UINT64 until)
+    {
+        while (!m_queue[ch].empty() && m_bus_free[ch] <= until) issue(ch);
+    }
+
+    // FR-FCFS: the oldest row-buffer hit goes first, otherwise the oldest request
+    void issue(UINT32 ch)
+    {
+        std::deque<Request>& q = m_queue[ch];
+        std::deque<Request>::iterator pick = q.begin();
+        if (m_policy == OPEN_PAGE)
+        {
+            for (std::deque<Request>::iterator it = q.begin(); it != q.end(); it++)
+            {
+                if (m_open_row[it->bank] == it->row)
+                {
+                    pick = it;
+                    break;
+                }
+            }
+        }
+        Request req = *pick;
+        q.erase(pick);
+
+        UINT64 start = req.arrival > m_bank_ready[req.bank] ? req.arrival : m_bank_ready[req.bank];
+
+        UINT32 cmd_lat;
+        if (m_open_row[req.bank] == req.row)
+        {
+            m_row_hits++;
+            cmd_lat = m_t.tCL;
+        }
+        else if (m_open_row[req.bank] == NO_ROW)
+        {
+            m_row_empty++;
+            cmd_lat = m_t.tRCD + m_t.tCL;
+        }
+        else
+        {
+            m_row_conflicts++;
+            cmd_lat = m_t.tRP + m_t.tRCD + m_t.tCL;
+        }
+
+        UINT64 data_start = start + cmd_lat;
+        if (data_start < m_bus_free[ch]) data_start = m_bus_free[ch];
+        UINT64 done = data_start + m_t.tBURST;
+        m_bus_free[ch] = done;
+
+        if (m_policy == OPEN_PAGE)
+        {
+            m_open_row[req.bank] = req.row;
+            m_bank_ready[req.bank] = done;
+        }
+        else
+        {
+            // 关闭页策略: 访问完成后立即预充电
+            m_open_row[req.bank] = NO_ROW;
+            m_bank_ready[req.bank] = done + m_t.tRP;
+        }
+
+        UINT64 latency = done - req.arrival;
+        if (req.is_write)
+        {
+            m_writes++;
+            m_wr_latency += latency;
+        }
+        else
+        {
+            m_reads++;
+            m_rd_latency += latency;
+            if (latency > m_max_rd_latency) m_max_rd_latency = latency;
+        }
+    }
+};
+
 /**************************************
  * Cache Model Base Class
 **************************************/
@@ -42,16 +374,20 @@ class CacheModel
 public:
     // Constructor
     CacheModel(UINT32 block_num, UINT32 log_block_size)
-        : m_block_num(block_num), m_blksz_log(log_block_size),
+        : m_block_num(block_num), m_blksz_log(log_block_size), m_mem(NULL), m_mem_cpa(0),
           m_rd_reqs(0), m_wr_reqs(0), m_rd_hits(0), m_wr_hits(0)
     {
+        memset(m_acc, 0, sizeof(m_acc));
         m_valids = new bool[m_block_num];
+        m_dirty = new bool[m_block_num];
         m_tags = new UINT32[m_block_num];
+        m_line_addr = new UINT32[m_block_num];
         m_replace_q = new UINT32[m_block_num];
 
         for (UINT i = 0; i < m_block_num; i++)
         {
             m_valids[i] = false;
+            m_dirty[i] = false;
             m_replace_q[i] = i;
         }
     }
@@ -60,26 +396,100 @@ public:
     virtual ~CacheModel()
     {
         delete[] m_valids;
+        delete[] m_dirty;
         delete[] m_tags;
+        delete[] m_line_addr;
         delete[] m_replace_q;
+        delete m_mem;
+    }
+
+    // Attach a DRAM model behind this cache; the cache takes ownership of it.
+    // cycles_per_access: DRAM cycles elapsed between two consecutive cache accesses
+    void setMemory(DramModel* mem, UINT32 cycles_per_access)
+    {
+        m_mem = mem;
+        m_mem_cpa = cycles_per_access;
     }
 
-    // Update the cache state whenever data is read
-    void readReq(UINT32 mem_addr)
+    // Update the cache state whenever data is read, return whether it hit
+    bool readReq(UINT32 mem_addr)
     {
         m_rd_reqs++;
-        if (access(mem_addr)) m_rd_hits++;
+        if (m_mem) m_mem->advance(m_mem_cpa);
+        if (!access(mem_addr, false)) return false;
+        m_rd_hits++;
+        return true;
     }
 
     // Update the cache state whenever data is written
     void writeReq(UINT32 mem_addr)
     {
         m_wr_reqs++;
-        if (access(mem_addr)) m_wr_hits++;
+        if (m_mem) m_mem->advance(m_mem_cpa);
+        if (access(mem_addr, true)) m_wr_hits++;
     }
 
-    UINT32 getRdReq() { return m_rd_reqs; }
-    UINT32 getWrReq() { return m_wr_reqs; }
+    UINT64 getRdReq() { return m_rd_reqs; }
+    UINT64 getWrReq() { return m_wr_reqs; }
+    UINT64 getRdHits() { return m_rd_hits; }
+
+    // Clear the statistics but keep the cache contents (used after warm-up)
+    void resetStats()
+    {
+        m_rd_reqs = m_wr_reqs = m_rd_hits = m_wr_hits = 0;
+        if (m_mem) m_mem->resetStats();
+    }
+
+    // Add the statistics of this window, scaled by weight, to the accumulated totals
+    void accumulate(double weight)
+    {
+        m_acc[0] += weight * m_rd_reqs;
+        m_acc[1] += weight * m_wr_reqs;
+        m_acc[2] += weight * m_rd_hits;
+        m_acc[3] += weight * m_wr_hits;
+        if (m_mem) m_mem->accumulate(weight);
+    }
+
+    // Replace the statistics with the accumulated totals before dumping
+    void useAccumulated()
+    {
+        m_rd_reqs = (UINT64)(m_acc[0] + 0.5);
+        m_wr_reqs = (UINT64)(m_acc[1] + 0.5);
+        m_rd_hits = (UINT64)(m_acc[2] + 0.5);
+        m_wr_hits = (UINT64)(m_acc[3] + 0.5);
+        if (m_mem) m_mem->useAccumulated();
+    }
+
+    // Write tags, valid/dirty bits, replacement state and statistics to a checkpoint
+    void save(CkptWriter& w)
+    {
+        w.putBits(m_valids, m_block_num);
+        w.putBits(m_dirty, m_block_num);
+        w.putArray(m_tags, m_block_num);
+        w.putArray(m_line_addr, m_block_num);
+        w.putArray(m_replace_q, m_block_num);
+        w.put(m_rd_reqs);
+        w.put(m_wr_reqs);
+        w.put(m_rd_hits);
+        w.put(m_wr_hits);
+        w.putArray(m_acc, 4);
+        if (m_mem) m_mem->save(w);
+    }
+
+    void load(CkptReader& r)
+    {
+        r.getBits(m_valids, m_block_num);
+        r.getBits(m_dirty, m_block_num);
+        r.getArray(m_tags, m_block_num);
+        r.getArray(m_line_addr, m_block_num);
+        r.getArray(m_replace_q, m_block_num);
+        r.get(m_rd_reqs);
+        r.get(m_wr_reqs);
+        r.get(m_rd_hits);
+        r.get(m_wr_hits);
+        r.getArray(m_acc, 4);
+        if (m_mem) m_mem->load(r);
+    }
 
     void dumpResults()
     {
@@ -87,6 +497,7 @@ public:
         float wrHitRate = 100 * (float)m_wr_hits/m_wr_reqs;
         printf("\tread req: %lu,\thit: %lu,\thit rate: %.2f%%\n", m_rd_reqs, m_rd_hits, rdHitRate);
         printf("\twrite req: %lu,\thit: %lu,\thit rate: %.2f%%\n", m_wr_reqs, m_wr_hits, wrHitRate);
+        if (m_mem) m_mem->dumpResults();
     }
 
 protected:
@@ -94,22 +505,48 @@ protected:
     UINT32 m_blksz_log;     // 块大小的对数
 
     bool* m_valids;
+    bool* m_dirty;
     UINT32* m_tags;
+    UINT32* m_line_addr;    // 各块在下一级存储中的行地址, 用于写回
     UINT32* m_replace_q;    // Cache块替换的候选队列
 
+    DramModel* m_mem;       // 下一级存储, 为NULL时miss不再向下传递
+    UINT32 m_mem_cpa;
+
     UINT64 m_rd_reqs;       // The number of read-requests
     UINT64 m_wr_reqs;       // The number of write-requests
     UINT64 m_rd_hits;       // The number of hit read-requests
     UINT64 m_wr_hits;       // The number of hit write-requests
+    double m_acc[4];        // SimPoint加权累加的统计结果
 
     // Look up the cache to decide whether the access is hit or missed
     virtual bool lookup(UINT32 mem_addr, UINT32& blk_id) = 0;
 
     // Access the cache: update m_replace_q if hit, otherwise replace a block and update m_replace_q
-    virtual bool access(UINT32 mem_addr) = 0;
+    virtual bool access(UINT32 mem_addr, bool is_write) = 0;
 
     // Update m_replace_q
     virtual void updateReplaceQ(UINT32 blk_id) = 0;
+
+    // Mark a hit block dirty on write
+    void touch(UINT32 blk_id, bool is_write)
+    {
+        if (is_write) m_dirty[blk_id] = true;
+    }
+
+    // Refill blk_id with the line holding mem_addr: write the dirty victim back, then fetch the new line
+    void fill(UINT32 blk_id, UINT32 mem_addr, bool is_write)
+    {
+        UINT32 line_addr = (mem_addr >> m_blksz_log) << m_blksz_log;
+        if (m_mem)
+        {
+            if (m_valids[blk_id] && m_dirty[blk_id]) m_mem->request(m_line_addr[blk_id], true);
+            m_mem->request(line_addr, false);
+        }
+        m_valids[blk_id] = true;
+        m_dirty[blk_id] = is_write;
+        m_line_addr[blk_id] = line_addr;
+    }
 };
 
 /**************************************
@@ -136,7 +573,7 @@ private:
         UINT32 tag = getTag(mem_addr);
 
         for(blk_id=0;blk_id < m_block_num; blk_id++){
-            if (m_tags[blk_id] == tag) {
+            if (m_valids[blk_id] && m_tags[blk_id] == tag) {
                 return true;
             }
         }
@@ -144,12 +581,13 @@ private:
     }
 
     // Access the cache: update m_replace_q if hit, otherwise replace a block and update m_replace_q
-    bool access(UINT32 mem_addr)
+    bool access(UINT32 mem_addr, bool is_write)
     {
         UINT32 blk_id;
         if (lookup(mem_addr, blk_id))
         {
             updateReplaceQ(blk_id);     // Update m_replace_q
+            touch(blk_id, is_write);
             return true;
         }
 
@@ -157,6 +595,7 @@ private:
         UINT32 bid_2be_replaced = m_replace_q[m_block_num-1];
 
         // Replace the cache block
+        fill(bid_2be_replaced, mem_addr, is_write);
         m_tags[bid_2be_replaced] = getTag(mem_addr);
         updateReplaceQ(bid_2be_replaced);
 
@@ -172,7 +611,7 @@ private:
                 break;
             }
         }
-        memcpy(&m_replace_q[1], &m_replace_q, sizeof(UINT32)*(loc));
+        memmove(&m_replace_q[1], m_replace_q, sizeof(UINT32)*(loc));
         m_replace_q[0] = blk_id;
     }
 };
@@ -210,7 +649,7 @@ private:
         UINT32 setIdx = getSetIdx(mem_addr);
         UINT32 tag = getTag(mem_addr);
         for (blk_id = setIdx << m_setsz_log; blk_id < (setIdx+1) << m_setsz_log; blk_id++){
-            if(m_tags[blk_id] == tag) {
+            if(m_valids[blk_id] && m_tags[blk_id] == tag) {
                 return true;
             }
         }
@@ -218,19 +657,20 @@ private:
     }
 
     // Access the cache: update m_replace_q if hit, otherwise replace a block and update m_replace_q
-    bool access(UINT32 mem_addr)
+    bool access(UINT32 mem_addr, bool is_write)
     {
         UINT32 blk_id;
         if (lookup(mem_addr, blk_id))
         {
             updateReplaceQ(blk_id);     // Update m_replace_q
+            touch(blk_id, is_write);
             return true;
         }
 
         // Get the to-be-replaced block id using m_replace_q
         UINT32 setIdx = getSetIdx(mem_addr);
         UINT32 bid_2be_replaced;
-        for(int i = m_block_num; i >= 0; i++){
+        for(int i = m_block_num - 1; i >= 0; i--){
             if(m_replace_q[i] >> m_setsz_log == setIdx) {
                 bid_2be_replaced = m_replace_q[i];
                 break;
@@ -238,6 +678,7 @@ private:
         }
 
         // Replace the cache block
+        fill(bid_2be_replaced, mem_addr, is_write);
         m_tags[bid_2be_replaced] = getTag(mem_addr);
         updateReplaceQ(bid_2be_replaced);
 
@@ -253,7 +694,7 @@ private:
                 break;
             }
         }
-        memcpy(&m_replace_q[1], &m_replace_q, sizeof(UINT32)*(loc));
+        memmove(&m_replace_q[1], m_replace_q, sizeof(UINT32)*(loc));
         m_replace_q[0] = blk_id;
     }
 };
@@ -293,7 +734,7 @@ private:
         UINT32 setIdx = getSetIdx(mem_addr);
         UINT32 tag = getTag(mem_addr);
         for (blk_id = setIdx << m_setsz_log; blk_id < (setIdx+1) << m_setsz_log; blk_id++){
-            if(m_tags[blk_id] == tag) {
+            if(m_valids[blk_id] && m_tags[blk_id] == tag) {
                 return true;
             }
         }
@@ -301,19 +742,20 @@ private:
     }
 
     // Access the cache: update m_replace_q if hit, otherwise replace a block and update m_replace_q
-    bool access(UINT32 mem_addr)
+    bool access(UINT32 mem_addr, bool is_write)
     {
         UINT32 blk_id;
         if (lookup(mem_addr, blk_id))
         {
             updateReplaceQ(blk_id);     // Update m_replace_q
+            touch(blk_id, is_write);
             return true;
         }
 
         // Get the to-be-replaced block id using m_replace_q
         UINT32 setIdx = getSetIdx(mem_addr);
         UINT32 bid_2be_replaced;
-        for(int i = m_block_num; i >= 0; i++){
+        for(int i = m_block_num - 1; i >= 0; i--){
             if(m_replace_q[i] >> m_setsz_log == setIdx) {
                 bid_2be_replaced = m_replace_q[i];
                 break;
@@ -321,6 +763,7 @@ private:
         }
 
         // Replace the cache block
+        fill(bid_2be_replaced, mem_addr, is_write);
         m_tags[bid_2be_replaced] = getTag(mem_addr);
         updateReplaceQ(bid_2be_replaced);
 
@@ -336,7 +779,7 @@ private:
                 break;
             }
         }
-        memcpy(&m_replace_q[1], &m_replace_q, sizeof(UINT32)*(loc));
+        memmove(&m_replace_q[1], m_replace_q, sizeof(UINT32)*(loc));
         m_replace_q[0] = blk_id;
     }
 };
@@ -375,7 +818,7 @@ private:
         UINT32 setIdx = getSetIdx(mem_paddr);
         UINT32 tag = getTag(mem_paddr);
         for (blk_id = setIdx << m_setsz_log; blk_id < (setIdx+1) << m_setsz_log; blk_id++){
-            if(m_tags[blk_id] == tag) {
+            if(m_valids[blk_id] && m_tags[blk_id] == tag) {
                 return true;
             }
         }
@@ -383,20 +826,21 @@ private:
     }
 
     // Access the cache: update m_replace_q if hit, otherwise replace a block and update m_replace_q
-    bool access(UINT32 mem_vaddr)
+    bool access(UINT32 mem_vaddr, bool is_write)
     {
         UINT32 blk_id;
         UINT32 mem_paddr = get_phy_addr(mem_vaddr);
         if (lookup(mem_paddr, blk_id))
         {
             updateReplaceQ(blk_id);     // Update m_replace_q
+            touch(blk_id, is_write);
             return true;
         }
 
         // Get the to-be-replaced block id using m_replace_q
         UINT32 setIdx = getSetIdx(mem_paddr);
         UINT32 bid_2be_replaced;
-        for(int i = m_block_num; i >= 0; i++){
+        for(int i = m_block_num - 1; i >= 0; i--){
             if(m_replace_q[i] >> m_setsz_log == setIdx) {
                 bid_2be_replaced = m_replace_q[i];
                 break;
@@ -404,6 +848,7 @@ private:
         }
 
         // Replace the cache block
+        fill(bid_2be_replaced, mem_paddr, is_write);
         m_tags[bid_2be_replaced] = getTag(mem_paddr);
         updateReplaceQ(bid_2be_replaced);
 
@@ -419,7 +864,7 @@ private:
                 break;
             }
         }
-        memcpy(&m_replace_q[1], &m_replace_q, sizeof(UINT32)*(loc));
+        memmove(&m_replace_q[1], m_replace_q, sizeof(UINT32)*(loc));
         m_replace_q[0] = blk_id;
     }
 };
@@ -460,7 +905,7 @@ private:
         UINT32 mem_paddr = get_phy_addr(mem_vaddr);
         UINT32 tag = getTag(mem_paddr);
         for (blk_id = setIdx << m_setsz_log; blk_id < (setIdx+1) << m_setsz_log; blk_id++){
-            if(m_tags[blk_id] == tag) {
+            if(m_valids[blk_id] && m_tags[blk_id] == tag) {
                 return true;
             }
         }
@@ -468,20 +913,21 @@ private:
     }
 
     // Access the cache: update m_replace_q if hit, otherwise replace a block and update m_replace_q
-    bool access(UINT32 mem_vaddr)
+    bool access(UINT32 mem_vaddr, bool is_write)
     {
         UINT32 blk_id;
         UINT32 mem_paddr = get_phy_addr(mem_vaddr);
         if (lookup(mem_vaddr, blk_id))
         {
             updateReplaceQ(blk_id);     // Update m_replace_q
+            touch(blk_id, is_write);
             return true;
         }
 
         // Get the to-be-replaced block id using m_replace_q
         UINT32 setIdx = getSetIdx(mem_vaddr);
         UINT32 bid_2be_replaced;
-        for(int i = m_block_num; i >= 0; i++){
+        for(int i = m_block_num - 1; i >= 0; i--){
             if(m_replace_q[i] >> m_setsz_log == setIdx) {
                 bid_2be_replaced = m_replace_q[i];
                 break;
@@ -489,6 +935,7 @@ private:
         }
 
         // Replace the cache block
+        fill(bid_2be_replaced, mem_paddr, is_write);
         m_tags[bid_2be_replaced] = getTag(mem_paddr);
         updateReplaceQ(bid_2be_replaced);
 
@@ -504,7 +951,7 @@ private:
                 break;
             }
         }
-        memcpy(&m_replace_q[1], &m_replace_q, sizeof(UINT32)*(loc));
+        memmove(&m_replace_q[1], m_replace_q, sizeof(UINT32)*(loc));
         m_replace_q[0] = blk_id;
     }
 };
@@ -557,18 +1004,264 @@ KNOB<UINT32> KnobSetsLog(KNOB_MODE_WRITEONCE, "pintool",
 KNOB<UINT32> KnobAssociativity(KNOB_MODE_WRITEONCE, "pintool",
         "a", "4", "specify the m_asso");
 
+// This knob enables the instruction cache model
+KNOB<BOOL> KnobICache(KNOB_MODE_WRITEONCE, "pintool",
+        "icache", "0", "model an instruction cache fed by the basic-block fetch stream");
+
+KNOB<UINT32> KnobIBlockNum(KNOB_MODE_WRITEONCE, "pintool",
+        "in", "512", "specify the number of blocks of the instruction cache");
+
+KNOB<UINT32> KnobIAssociativity(KNOB_MODE_WRITEONCE, "pintool",
+        "ia", "4", "specify the m_asso of the instruction cache");
+
+KNOB<UINT32> KnobITopN(KNOB_MODE_WRITEONCE, "pintool",
+        "itop", "20", "specify the number of functions listed in the I-miss report");
+
+// This knob enables the DRAM model behind every cache (off by default, so the plain hit/miss runs keep their cost)
+KNOB<BOOL> KnobDram(KNOB_MODE_WRITEONCE, "pintool",
+        "dram", "0", "attach a DRAM timing model behind each cache (-dram 1 to enable)");
+
+KNOB<UINT32> KnobDramChannelsLog(KNOB_MODE_WRITEONCE, "pintool",
+        "dch", "0", "specify the log of the number of DRAM channels");
+
+KNOB<UINT32> KnobDramRanksLog(KNOB_MODE_WRITEONCE, "pintool",
+        "drk", "1", "specify the log of the number of ranks per channel");
+
+KNOB<UINT32> KnobDramBanksLog(KNOB_MODE_WRITEONCE, "pintool",
+        "dbk", "3", "specify the log of the number of banks per rank");
+
+KNOB<UINT32> KnobDramRowSizeLog(KNOB_MODE_WRITEONCE, "pintool",
+        "drow", "13", "specify the log of the row buffer size in bytes");
+
+KNOB<std::string> KnobDramPolicy(KNOB_MODE_WRITEONCE, "pintool",
+        "dpolicy", "open", "specify the row buffer policy: open, closed");
+
+KNOB<std::string> KnobDramMap(KNOB_MODE_WRITEONCE, "pintool",
+        "dmap", "ro_ba_ra_co_ch", "specify the address mapping: ro_ba_ra_co_ch, ro_ra_ba_ch_co, permute");
+
+KNOB<UINT32> KnobDramQueue(KNOB_MODE_WRITEONCE, "pintool",
+        "dq", "32", "specify the depth of the request queue per channel");
+
+KNOB<UINT32> KnobDramCPA(KNOB_MODE_WRITEONCE, "pintool",
+        "dcpa", "2", "specify the DRAM cycles elapsed per cache access");
+
+KNOB<std::string> KnobDramTiming(KNOB_MODE_WRITEONCE, "pintool",
+        "dtiming", "14,14,14,4", "specify tCL,tRCD,tRP,tBURST in DRAM cycles");
+
+// Build a DRAM model from the knobs above
+DramModel* newDram()
+{
+    DramTiming t = { 14, 14, 14, 4 };
+    sscanf(KnobDramTiming.Value().c_str(), "%u,%u,%u,%u", &t.tCL, &t.tRCD, &t.tRP, &t.tBURST);
+
+    DramModel::RowPolicy policy = KnobDramPolicy.Value() == "closed" ? DramModel::CLOSED_PAGE : DramModel::OPEN_PAGE;
+    DramModel::AddrMap map = DramModel::MAP_RO_BA_RA_CO_CH;
+    if (KnobDramMap.Value() == "ro_ra_ba_ch_co") map = DramModel::MAP_RO_RA_BA_CH_CO;
+    else if (KnobDramMap.Value() == "permute") map = DramModel::MAP_PERMUTE;
+
+    return new DramModel(KnobDramChannelsLog.Value(), KnobDramRanksLog.Value(), KnobDramBanksLog.Value(),
+                         KnobDramRowSizeLog.Value(), KnobBlockSizeLog.Value(), policy, map,
+                         KnobDramQueue.Value(), t);
+}
+
+/**************************************
+ * Instruction fetch stream
+**************************************/
+CacheModel* my_icache;
+UINT64 fetchedIns = 0;                  // 执行的指令数, 用于计算MPKI
+std::set<UINT32> fetchedLines;          // 执行过的指令cache行 (footprint)
+double accFetchedIns = 0;
+
+// Per-function I-miss statistics
+struct FuncFetchStat
+{
+    std::string name;
+    UINT64 fetches;
+    UINT64 misses;
+    double acc_fetches;
+    double acc_misses;
+};
+std::map<ADDRINT, FuncFetchStat*> funcFetchStats;
+
+// Lines fetched by one basic block, computed once at instrumentation time
+struct BblFetch
+{
+    UINT32 ninst;
+    UINT32 nlines;
+    bool touched;               // 是否已计入footprint
+    FuncFetchStat* func;
+    UINT32 lines[1];            // 实际长度为nlines
+};
+
+// 以(BBL地址, 字节数)为键, 代码缓存清空或切换阶段重新插桩时复用同一记录.
+// 同一地址开始的BBL在不同trace中可能长度不同, 因此长度也是键的一部分
+std::map<std::pair<ADDRINT, USIZE>, BblFetch*> bblFetches;
+
+// Instruction fetch analysis routine: one call per basic block execution
+void fetchBbl(BblFetch* b)
+{
+    fetchedIns += b->ninst;
+    b->func->fetches += b->nlines;
+    for (UINT32 i = 0; i < b->nlines; i++)
+        if (!my_icache->readReq(b->lines[i])) b->func->misses++;
+
+    if (!b->touched)
+    {
+        b->touched = true;
+        fetchedLines.insert(b->lines, b->lines + b->nlines);
+    }
+}
+
+FuncFetchStat* getFuncFetchStat(ADDRINT addr)
+{
+    RTN rtn = RTN_FindByAddress(addr);
+    ADDRINT key = RTN_Valid(rtn) ? RTN_Address(rtn) : 0;
+
+    std::map<ADDRINT, FuncFetchStat*>::iterator it = funcFetchStats.find(key);
+    if (it != funcFetchStats.end()) return it->second;
+
+    FuncFetchStat* f = new FuncFetchStat();
+    f->name = RTN_Valid(rtn) ? RTN_Name(rtn) : "[unknown]";
+    f->fetches = 0;
+    f->misses = 0;
+    f->acc_fetches = 0;
+    f->acc_misses = 0;
+    funcFetchStats[key] = f;
+    return f;
+}
+
+// Pin calls this function every time a new trace is encountered
+VOID Trace(TRACE trace, VOID *v)
+{
+    if (!phaseCtrl.instrumenting()) return;
+
+    UINT32 blksz_log = KnobBlockSizeLog.Value();
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        BblFetch*& b = bblFetches[std::make_pair(BBL_Address(bbl), BBL_Size(bbl))];
+        if (b == NULL)
+        {
+            ADDRINT first = BBL_Address(bbl) >> blksz_log;
+            ADDRINT last = (BBL_Address(bbl) + BBL_Size(bbl) - 1) >> blksz_log;
+            UINT32 nlines = last - first + 1;
+
+            b = (BblFetch*)malloc(sizeof(BblFetch) + sizeof(UINT32) * (nlines - 1));
+            b->ninst = BBL_NumIns(bbl);
+            b->nlines = nlines;
+            b->touched = false;
+            b->func = getFuncFetchStat(BBL_Address(bbl));
+            for (UINT32 i = 0; i < nlines; i++)
+                b->lines[i] = (UINT32)((first + i) << blksz_log);
+        }
+
+        BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)fetchBbl, IARG_PTR, b, IARG_END);
+    }
+}
+
+bool cmpFetchMisses(const FuncFetchStat* a, const FuncFetchStat* b) { return a->misses > b->misses; }
+
+void dumpICacheResults()
+{
+    printf("\nInstruction Cache:\n");
+    my_icache->dumpResults();
+
+    float mpki = fetchedIns ? 1000 * (float)(my_icache->getRdReq() - my_icache->getRdHits()) / fetchedIns : 0;
+    printf("\tinstructions: %lu,\tI-cache MPKI: %.3f\n", fetchedIns, mpki);
+    printf("\tfootprint: %lu lines (%lu KB)\n", (UINT64)fetchedLines.size(),
+           ((UINT64)fetchedLines.size() << KnobBlockSizeLog.Value()) >> 10);
+
+    std::vector<FuncFetchStat*> funcs;
+    for (std::map<ADDRINT, FuncFetchStat*>::iterator it = funcFetchStats.begin(); it != funcFetchStats.end(); it++)
+        funcs.push_back(it->second);
+    std::sort(funcs.begin(), funcs.end(), cmpFetchMisses);
+
+    printf("\tTop I-miss functions:\n");
+    for (UINT32 i = 0; i < funcs.size() && i < KnobITopN.Value() && funcs[i]->misses; i++)
+        printf("\t%12lu misses\t%12lu fetches\t%s\n", funcs[i]->misses, funcs[i]->fetches, funcs[i]->name.c_str());
+}
+
 // Pin calls this function every time a new instruction is encountered
 VOID Instruction(INS ins, VOID *v)
 {
+    if (!phaseCtrl.instrumenting()) return;
+
     if (INS_IsMemoryRead(ins))
         INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)readCache, IARG_MEMORYREAD_EA, IARG_END);
     if (INS_IsMemoryWrite(ins))
         INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)writeCache, IARG_MEMORYWRITE_EA, IARG_END);
 }
 
-// This function is called when the application exits
-VOID Fini(INT32 code, VOID *v)
+// Clear the statistics gathered during warm-up
+void beginMeasure()
+{
+    my_fa_cache->resetStats();
+    my_sa_cache->resetStats();
+    my_sa_cache_vivt->resetStats();
+    my_sa_cache_pipt->resetStats();
+    my_sa_cache_vipt->resetStats();
+
+    if (KnobICache.Value())
+    {
+        my_icache->resetStats();
+        fetchedIns = 0;
+        if (!phaseCtrl.sampling())
+        {
+            fetchedLines.clear();
+            for (std::map<std::pair<ADDRINT, USIZE>, BblFetch*>::iterator it = bblFetches.begin(); it != bblFetches.end(); it++)
+                it->second->touched = false;
+        }
+        for (std::map<ADDRINT, FuncFetchStat*>::iterator it = funcFetchStats.begin(); it != funcFetchStats.end(); it++)
+            it->second->fetches = it->second->misses = 0;
+    }
+}
+
+// Accumulate the weighted statistics of a simulation point
+void endRegion(double weight)
 {
+    my_fa_cache->accumulate(weight);
+    my_sa_cache->accumulate(weight);
+    my_sa_cache_vivt->accumulate(weight);
+    my_sa_cache_pipt->accumulate(weight);
+    my_sa_cache_vipt->accumulate(weight);
+
+    if (KnobICache.Value())
+    {
+        my_icache->accumulate(weight);
+        accFetchedIns += weight * fetchedIns;
+        for (std::map<ADDRINT, FuncFetchStat*>::iterator it = funcFetchStats.begin(); it != funcFetchStats.end(); it++)
+        {
+            it->second->acc_fetches += weight * it->second->fetches;
+            it->second->acc_misses += weight * it->second->misses;
+        }
+    }
+}
+
+// Print the results of all caches
+void dumpResults()
+{
+    if (phaseCtrl.sampling())
+    {
+        // The footprint is the union over all simulation points and is not weighted
+        printf("\nResults reconstructed from %u simulation points (counts are per-interval estimates)\n",
+               phaseCtrl.numRegions());
+        my_fa_cache->useAccumulated();
+        my_sa_cache->useAccumulated();
+        my_sa_cache_vivt->useAccumulated();
+        my_sa_cache_pipt->useAccumulated();
+        my_sa_cache_vipt->useAccumulated();
+
+        if (KnobICache.Value())
+        {
+            my_icache->useAccumulated();
+            fetchedIns = (UINT64)(accFetchedIns + 0.5);
+            for (std::map<ADDRINT, FuncFetchStat*>::iterator it = funcFetchStats.begin(); it != funcFetchStats.end(); it++)
+            {
+                it->second->fetches = (UINT64)(it->second->acc_fetches + 0.5);
+                it->second->misses = (UINT64)(it->second->acc_misses + 0.5);
+            }
+        }
+    }
+
     printf("\nFully Associative Cache:\n");
     my_fa_cache->dumpResults();
 
@@ -584,33 +1277,157 @@ VOID Fini(INT32 code, VOID *v)
     printf("\nSet-Associative Cache (VIPT):\n");
     my_sa_cache_vipt->dumpResults();
 
+    if (KnobICache.Value()) dumpICacheResults();
+}
+
+// Write the state of every model to a checkpoint
+void saveState(CkptWriter& w)
+{
+    my_fa_cache->save(w);
+    my_sa_cache->save(w);
+    my_sa_cache_vivt->save(w);
+    my_sa_cache_pipt->save(w);
+    my_sa_cache_vipt->save(w);
+
+    if (KnobICache.Value())
+    {
+        my_icache->save(w);
+        w.put(fetchedIns);
+        w.put(accFetchedIns);
+
+        w.put((UINT64)fetchedLines.size());
+        for (std::set<UINT32>::iterator it = fetchedLines.begin(); it != fetchedLines.end(); it++) w.put(*it);
+
+        w.put((UINT64)funcFetchStats.size());
+        for (std::map<ADDRINT, FuncFetchStat*>::iterator it = funcFetchStats.begin(); it != funcFetchStats.end(); it++)
+        {
+            FuncFetchStat* f = it->second;
+            w.put(it->first);
+            w.putString(f->name);
+            w.put(f->fetches);
+            w.put(f->misses);
+            w.put(f->acc_fetches);
+            w.put(f->acc_misses);
+        }
+    }
+}
+
+// Read the state written by saveState, in the same order
+void loadState(CkptReader& r)
+{
+    my_fa_cache->load(r);
+    my_sa_cache->load(r);
+    my_sa_cache_vivt->load(r);
+    my_sa_cache_pipt->load(r);
+    my_sa_cache_vipt->load(r);
+
+    if (KnobICache.Value())
+    {
+        my_icache->load(r);
+        r.get(fetchedIns);
+        r.get(accFetchedIns);
+
+        UINT64 n = 0;
+        r.get(n);
+        for (UINT64 i = 0; i < n && r.ok(); i++)
+        {
+            UINT32 line;
+            r.get(line);
+            fetchedLines.insert(line);
+        }
+
+        // Functions are keyed by address, which stays valid as long as the binary is loaded at the same place
+        r.get(n);
+        for (UINT64 i = 0; i < n && r.ok(); i++)
+        {
+            ADDRINT key = 0;
+            r.get(key);
+            FuncFetchStat* f = new FuncFetchStat();
+            f->name = r.getString();
+            r.get(f->fetches);
+            r.get(f->misses);
+            r.get(f->acc_fetches);
+            r.get(f->acc_misses);
+            funcFetchStats[key] = f;
+        }
+    }
+}
+
+// The shape of the saved arrays and every DRAM knob that shapes the saved open rows, queues and timing;
+// a checkpoint can only be restored into the same one
+std::string stateConfig()
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "n=%u,b=%u,a=%u,icache=%d,in=%u,ia=%u,dram=%d,dch=%u,drk=%u,dbk=%u,drow=%u,dq=%u,dcpa=%u",
+             KnobBlockNum.Value(), KnobBlockSizeLog.Value(), KnobAssociativity.Value(),
+             (int)KnobICache.Value(), KnobIBlockNum.Value(), KnobIAssociativity.Value(),
+             (int)KnobDram.Value(), KnobDramChannelsLog.Value(), KnobDramRanksLog.Value(), KnobDramBanksLog.Value(),
+             KnobDramRowSizeLog.Value(), KnobDramQueue.Value(), KnobDramCPA.Value());
+    return std::string(buf) + ",dpolicy=" + KnobDramPolicy.Value() + ",dmap=" + KnobDramMap.Value()
+           + ",dtiming=" + KnobDramTiming.Value();
+}
+
+// This function is called when the application exits
+VOID Fini(INT32 code, VOID *v)
+{
+    if (!phaseCtrl.measuring() && !phaseCtrl.sampling())
+        printf("\nWarning: the application exited before the measurement phase started\n");
+    phaseCtrl.atExit();
+    dumpResults();
+
     delete my_fa_cache;
     delete my_sa_cache;
 
     delete my_sa_cache_vivt;
     delete my_sa_cache_pipt;
     delete my_sa_cache_vipt;
+
+    if (KnobICache.Value()) delete my_icache;
 }
 
 // argc, argv are the entire command line, including pin -t <toolname> -- ...
 int main(int argc, char* argv[])
 {
     // Initialize pin
+    PIN_InitSymbols();
     PIN_Init(argc, argv);
 
     my_fa_cache = new FullAssoCache(KnobBlockNum.Value(), KnobBlockSizeLog.Value());
-    my_sa_cache = new SetAssoCache(KnobSetsLog.Value(), KnobBlockSizeLog.Value(), KnobAssociativity.Value());
+    my_sa_cache = new SetAssoCache(KnobBlockNum.Value(), KnobBlockSizeLog.Value(), KnobAssociativity.Value());
+
+    my_sa_cache_vivt = new SetAssoCache_VIVT(KnobBlockNum.Value(), KnobBlockSizeLog.Value(), KnobAssociativity.Value());
+    my_sa_cache_pipt = new SetAssoCache_PIPT(KnobBlockNum.Value(), KnobBlockSizeLog.Value(), KnobAssociativity.Value());
+    my_sa_cache_vipt = new SetAssoCache_VIPT(KnobBlockNum.Value(), KnobBlockSizeLog.Value(), KnobAssociativity.Value());
 
-    my_sa_cache_vivt = new SetAssoCache_VIVT(KnobSetsLog.Value(), KnobBlockSizeLog.Value(), KnobAssociativity.Value());
-    my_sa_cache_pipt = new SetAssoCache_PIPT(KnobSetsLog.Value(), KnobBlockSizeLog.Value(), KnobAssociativity.Value());
-    my_sa_cache_vipt = new SetAssoCache_VIPT(KnobSetsLog.Value(), KnobBlockSizeLog.Value(), KnobAssociativity.Value());
+    if (KnobDram.Value())
+    {
+        my_fa_cache->setMemory(newDram(), KnobDramCPA.Value());
+        my_sa_cache->setMemory(newDram(), KnobDramCPA.Value());
+        my_sa_cache_vivt->setMemory(newDram(), KnobDramCPA.Value());
+        my_sa_cache_pipt->setMemory(newDram(), KnobDramCPA.Value());
+        my_sa_cache_vipt->setMemory(newDram(), KnobDramCPA.Value());
+    }
 
     // Register Instruction to be called to instrument instructions
     INS_AddInstrumentFunction(Instruction, 0);
 
+    if (KnobICache.Value())
+    {
+        my_icache = new SetAssoCache(KnobIBlockNum.Value(), KnobBlockSizeLog.Value(), KnobIAssociativity.Value());
+
+        // Register Trace to be called to instrument basic blocks
+        TRACE_AddInstrumentFunction(Trace, 0);
+    }
+
     // Register Fini to be called when the application exits
     PIN_AddFiniFunction(Fini, 0);
 
+    // Restore a checkpoint and/or arrange for checkpoints to be written
+    if (!checkpointer.init("cacheModel", stateConfig(), saveState, loadState)) return 1;
+
+    // Results are dumped at detach if a measurement window is given
+    phaseCtrl.init(beginMeasure, endRegion, dumpResults);
+
     // Start the program, never returns
     PIN_StartProgram();
 
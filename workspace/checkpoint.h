@@ -0,0 +1,140 @@
+/**************************************
+ * Checkpoint / restore of model state
+ * shared by cacheModel and brchPredict
+ *
+ * 文件格式: magic, version, 工具名, 配置串, 指令位置, 之后是各模型按固定顺序写入的原始数据.
+ * 配置串描述数组的形状 (cache几何参数, 预测器参数), 不一致时拒绝恢复.
+**************************************/
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <csignal>
+#include <cstdio>
+#include <string>
+#include "pin.H"
+#include "ckptStream.h"
+#include "phaseCtrl.h"
+
+KNOB<std::string> KnobCkptOut(KNOB_MODE_WRITEONCE, "pintool",
+        "ckpt_out", "", "specify the file to write checkpoints to (on SIGUSR1 and every -ckpt_every instructions)");
+
+KNOB<UINT64> KnobCkptEvery(KNOB_MODE_WRITEONCE, "pintool",
+        "ckpt_every", "0", "specify the number of instructions between two checkpoints, 0 for signal only");
+
+KNOB<std::string> KnobCkptIn(KNOB_MODE_WRITEONCE, "pintool",
+        "ckpt_in", "", "specify a checkpoint file to restore the model state from at startup");
+
+KNOB<BOOL> KnobCkptResume(KNOB_MODE_WRITEONCE, "pintool",
+        "ckpt_resume", "0", "keep the restored statistics and fast-forward to the checkpointed position");
+
+class Checkpointer
+{
+public:
+    Checkpointer() : m_save(NULL), m_load(NULL) {}
+
+    // Call after the models are built and before phaseCtrl.init
+    // param:   tool:       name of the tool, stored in the file
+    //          config:     shape of the model state; a checkpoint is only restored into the same config
+    //          save/load:  write/read the state of every model in a fixed order
+    // Return false if -ckpt_in was given but cannot be restored
+    bool init(const std::string& tool, const std::string& config,
+              void (*save)(CkptWriter&), void (*load)(CkptReader&))
+    {
+        m_tool = tool;
+        m_config = config;
+        m_save = save;
+        m_load = load;
+
+        if (!KnobCkptIn.Value().empty())
+        {
+            UINT64 pos;
+            if (!restore(KnobCkptIn.Value(), pos))
+            {
+                fprintf(stderr, "%s: cannot restore checkpoint %s (missing, truncated or another configuration)\n",
+                        m_tool.c_str(), KnobCkptIn.Value().c_str());
+                return false;
+            }
+            fprintf(stderr, "%s: restored checkpoint %s taken at instruction %lu\n",
+                    m_tool.c_str(), KnobCkptIn.Value().c_str(), pos);
+            if (KnobCkptResume.Value()) phaseCtrl.resumeAt(pos);
+        }
+
+        if (!KnobCkptOut.Value().empty())
+        {
+            // 检查点记录的位置必须准确, 否则-ckpt_resume会从错误的位置重新计数
+            phaseCtrl.trackPosition();
+            if (KnobCkptEvery.Value()) phaseCtrl.setPeriodic(KnobCkptEvery.Value(), periodic);
+            PIN_InterceptSignal(SIGUSR1, onSignal, this);
+            PIN_UnblockSignal(SIGUSR1, TRUE);
+        }
+        return true;
+    }
+
+    // Write the state to -ckpt_out; the file is replaced atomically
+    bool save(UINT64 pos)
+    {
+        std::string tmp = KnobCkptOut.Value() + ".tmp";
+        FILE* f = fopen(tmp.c_str(), "wb");
+        CkptWriter w(f);
+        UINT64 magic = MAGIC;
+        UINT32 version = VERSION;
+        w.put(magic);
+        w.put(version);
+        w.putString(m_tool);
+        w.putString(m_config);
+        w.put(pos);
+        m_save(w);
+
+        bool ok = w.ok();
+        if (f && fclose(f) != 0) ok = false;
+        if (ok) ok = rename(tmp.c_str(), KnobCkptOut.Value().c_str()) == 0;
+        else remove(tmp.c_str());
+
+        fprintf(stderr, "%s: %s checkpoint %s at instruction %lu\n", m_tool.c_str(),
+                ok ? "wrote" : "failed to write", KnobCkptOut.Value().c_str(), pos);
+        return ok;
+    }
+
+private:
+    static const UINT64 MAGIC = 0x54504b434843524bULL;     // "KRCHCKPT"
+    static const UINT32 VERSION = 6;
+
+    std::string m_tool;
+    std::string m_config;
+    void (*m_save)(CkptWriter&);
+    void (*m_load)(CkptReader&);
+
+    bool restore(const std::string& path, UINT64& pos)
+    {
+        FILE* f = fopen(path.c_str(), "rb");
+        CkptReader r(f);
+        UINT64 magic = 0;
+        UINT32 version = 0;
+        r.get(magic);
+        r.get(version);
+        bool ok = r.ok() && magic == MAGIC && version == VERSION
+               && r.getString() == m_tool && r.getString() == m_config;
+        if (ok)
+        {
+            r.get(pos);
+            m_load(r);
+            ok = r.ok();
+        }
+        if (f) fclose(f);
+        return ok;
+    }
+
+    static VOID periodic(UINT64 pos);
+
+    static BOOL onSignal(THREADID tid, INT32 sig, CONTEXT* ctxt, BOOL hasHandler, const EXCEPTION_INFO* pExceptInfo, VOID* v)
+    {
+        ((Checkpointer*)v)->save(phaseCtrl.position());
+        return FALSE;       // 不把信号传给应用程序
+    }
+};
+
+Checkpointer checkpointer;
+
+VOID Checkpointer::periodic(UINT64 pos) { checkpointer.save(pos); }
+
+#endif
@@ -0,0 +1,89 @@
+/**************************************
+ * Checkpoint file streams
+ * 只依赖C库, 供checkpoint.h和离线的brchReplay共用
+**************************************/
+#ifndef CKPT_STREAM_H
+#define CKPT_STREAM_H
+
+#include <cstdio>
+#include <stdint.h>
+#include <string>
+
+class CkptWriter
+{
+public:
+    CkptWriter(FILE* f) : m_f(f), m_ok(f != NULL) {}
+
+    bool ok() { return m_ok; }
+
+    void put(const void* p, size_t n)
+    {
+        if (m_ok && n && fwrite(p, 1, n, m_f) != n) m_ok = false;
+    }
+
+    template<typename T> void put(const T& v) { put(&v, sizeof(T)); }
+    template<typename T> void putArray(const T* a, size_t n) { put(a, sizeof(T) * n); }
+
+    void putString(const std::string& s)
+    {
+        put((uint32_t)s.size());
+        put(s.data(), s.size());
+    }
+
+    // bool数组按位打包
+    void putBits(const bool* a, size_t n)
+    {
+        for (size_t i = 0; i < n; i += 8)
+        {
+            uint8_t byte = 0;
+            for (size_t j = 0; j < 8 && i + j < n; j++) byte |= (uint8_t)a[i + j] << j;
+            put(byte);
+        }
+    }
+
+private:
+    FILE* m_f;
+    bool m_ok;
+};
+
+class CkptReader
+{
+public:
+    CkptReader(FILE* f) : m_f(f), m_ok(f != NULL) {}
+
+    bool ok() { return m_ok; }
+
+    void get(void* p, size_t n)
+    {
+        if (m_ok && n && fread(p, 1, n, m_f) != n) m_ok = false;
+    }
+
+    template<typename T> void get(T& v) { get(&v, sizeof(T)); }
+    template<typename T> void getArray(T* a, size_t n) { get(a, sizeof(T) * n); }
+
+    std::string getString()
+    {
+        uint32_t n = 0;
+        get(n);
+        if (!m_ok || n > (1u << 20)) { m_ok = false; return ""; }
+        std::string s(n, '\0');
+        if (n) get(&s[0], n);
+        return s;
+    }
+
+    void getBits(bool* a, size_t n)
+    {
+        for (size_t i = 0; i < n; i += 8)
+        {
+            uint8_t byte = 0;
+            get(byte);
+            for (size_t j = 0; j < 8 && i + j < n; j++) a[i + j] = (byte >> j) & 1;
+        }
+    }
+
+private:
+    FILE* m_f;
+    bool m_ok;
+};
+
+#endif
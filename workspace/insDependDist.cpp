@@ -9,8 +9,11 @@
  * warranties, other than those that are expressly stated in the License.
  */
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <iomanip>
+#include <map>
 #include <vector>
 #include "pin.H"
 using std::cerr;
@@ -23,32 +26,352 @@ using std::vector;
 ofstream OutFile;
 
 // Convenience data structure
-typedef uint32_t reg_t;
+typedef UINT16 reg_t;
+
+// 每条插桩指令的寄存器描述, 读寄存器在前, 写寄存器在后, 紧跟在计数之后.
+// 记录按32字节对齐分配, 不超过15个寄存器的记录(几乎所有指令)只占半个cache line
 struct Registers
 {
-	vector<reg_t> read;
-	vector<reg_t> write;
+	UINT8 nread;
+	UINT8 nwrite;
+	reg_t regs[1];		// 实际长度为nread + nwrite
+
+	const reg_t* read() const { return regs; }
+	const reg_t* write() const { return regs + nread; }
+};
+
+static const size_t REG_RECORD_ALIGN = 32;
+
+// Bump-pointer arena for the register records. Records live as long as the
+// instrumented code that references them, so the whole arena is rewound when
+// Pin flushes the code cache instead of freeing records one by one.
+class RegArena
+{
+public:
+	RegArena() : m_cur(NULL), m_end(NULL) {}
+
+	Registers* alloc(UINT32 nregs)
+	{
+		size_t bytes = sizeof(Registers) + sizeof(reg_t) * (nregs ? nregs - 1 : 0);
+		bytes = (bytes + REG_RECORD_ALIGN - 1) & ~(REG_RECORD_ALIGN - 1);
+		if (m_cur == NULL || m_cur + bytes > m_end) nextBlock(bytes);
+		Registers* r = (Registers*)m_cur;
+		m_cur += bytes;
+		return r;
+	}
+
+	// 代码缓存被清空后, 没有插桩代码再引用任何记录, 保留第一块, 其余释放
+	void reset()
+	{
+		for (size_t i = 1; i < m_blocks.size(); i++) free(m_blocks[i].first);
+		if (m_blocks.size() > 1) m_blocks.resize(1);
+		m_cur = m_blocks.empty() ? NULL : align(m_blocks[0].first);
+		m_end = m_blocks.empty() ? NULL : m_blocks[0].first + m_blocks[0].second;
+	}
+
+	size_t bytes() const
+	{
+		size_t total = 0;
+		for (size_t i = 0; i < m_blocks.size(); i++) total += m_blocks[i].second;
+		return total;
+	}
+
+private:
+	static const size_t BLOCK_BYTES = 64 * 1024;
+	std::vector<std::pair<char*, size_t> > m_blocks;	// 起始地址, 字节数
+	char* m_cur;
+	char* m_end;
+
+	static char* align(char* p)
+	{
+		return (char*)(((ADDRINT)p + REG_RECORD_ALIGN - 1) & ~(ADDRINT)(REG_RECORD_ALIGN - 1));
+	}
+
+	void nextBlock(size_t bytes)
+	{
+		size_t size = std::max(BLOCK_BYTES, bytes + REG_RECORD_ALIGN);
+		m_blocks.push_back(std::make_pair((char*)malloc(size), size));
+		m_cur = align(m_blocks.back().first);
+		m_end = m_blocks.back().first + size;
+	}
+};
+
+RegArena regArena;
+UINT64 cacheFlushes = 0;
+
+// Dependency distance histogram. Distances below HIST_EXACT have a bucket each, longer ones
+// share HDR-style log-linear buckets: 2^HIST_SUB_BITS buckets per power of two, so any
+// UINT64 distance is kept with relative error below 1/2^HIST_SUB_BITS in 4.6 KB.
+static const UINT32 HIST_EXACT_BITS = 7;
+static const UINT32 HIST_SUB_BITS = 3;
+static const UINT64 HIST_EXACT = 1ULL << HIST_EXACT_BITS;
+static const UINT32 HIST_BUCKETS = HIST_EXACT + ((64 - HIST_EXACT_BITS) << HIST_SUB_BITS);
+
+struct DistHistogram
+{
+	UINT64 counts[HIST_BUCKETS];
+
+	// 无分支, 以便内联: 指数至少取HIST_EXACT_BITS, 精确区的移位量不会为负
+	static UINT32 bucket(UINT64 d)
+	{
+		UINT32 e = 63 - __builtin_clzll(d | 1);
+		e = e > HIST_EXACT_BITS ? e : HIST_EXACT_BITS;
+		UINT32 sub = (UINT32)(d >> (e - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1);
+		UINT32 log_bucket = (UINT32)HIST_EXACT + ((e - HIST_EXACT_BITS) << HIST_SUB_BITS) + sub;
+		return d < HIST_EXACT ? (UINT32)d : log_bucket;
+	}
+
+	// Smallest and largest distance counted in bucket b
+	static UINT64 lower(UINT32 b)
+	{
+		if (b < HIST_EXACT) return b;
+		UINT32 e = HIST_EXACT_BITS + ((b - HIST_EXACT) >> HIST_SUB_BITS);
+		UINT64 sub = ((b - HIST_EXACT) & ((1 << HIST_SUB_BITS) - 1)) | (1 << HIST_SUB_BITS);
+		return sub << (e - HIST_SUB_BITS);
+	}
+
+	static UINT64 upper(UINT32 b) { return b + 1 == HIST_BUCKETS ? ~0ULL : lower(b + 1) - 1; }
+
+	void merge(const DistHistogram &h)
+	{
+		for (UINT32 b = 0; b < HIST_BUCKETS; b++) counts[b] += h.counts[b];
+	}
+
+	UINT64 total() const
+	{
+		UINT64 n = 0;
+		for (UINT32 b = 0; b < HIST_BUCKETS; b++) n += counts[b];
+		return n;
+	}
+
+	// 第p百分位所在桶的上界 (与HdrHistogram相同, 报告等价范围内的最大值)
+	UINT64 percentile(double p) const
+	{
+		UINT64 n = total(), seen = 0;
+		UINT64 rank = (UINT64)(p / 100 * n + 0.5);
+		if (rank == 0) rank = 1;
+		for (UINT32 b = 0; b < HIST_BUCKETS; b++)
+		{
+			seen += counts[b];
+			if (seen >= rank) return upper(b);
+		}
+		return 0;
+	}
+};
+
+/* ===================================================================== */
+/* Shadow memory for load-after-store dependencies                       */
+/* ===================================================================== */
+// 每个8字节granule记录最后写它的指令: 指令序号(所在线程内), store指令编号, 线程
+struct ShadowEntry
+{
+	UINT64 insNum;		// 0为还没有被写过
+	UINT32 store;		// storePcs的下标
+	UINT32 tid;
 };
 
+static const UINT32 GRANULE_BITS = 3;
+static const UINT32 SHADOW_PAGE_BITS = 12;		// 每个影子页对应4KB地址
+static const UINT32 SHADOW_DIR_BITS = 16;
+
+struct ShadowPage
+{
+	ADDRINT page;			// addr >> SHADOW_PAGE_BITS
+	ShadowPage *next;		// 同一目录项的下一页
+	ShadowEntry entries[1 << (SHADOW_PAGE_BITS - GRANULE_BITS)];
+};
+
+// Two-level map from address granule to its last writer. The first level is a
+// directory indexed by the hashed page number whose slots chain the pages that
+// hash there; pages are allocated zeroed on the first store and never freed,
+// so readers walk the chains without the lock and only insertion takes it.
+class ShadowMemory
+{
+public:
+	ShadowMemory() : m_pages(0) { PIN_InitLock(&m_lock); }
+
+	// Page holding addr, NULL if nothing in it was ever stored to
+	ShadowPage *find(ADDRINT page)
+	{
+		for (ShadowPage *p = m_dir[slot(page)]; p != NULL; p = p->next)
+			if (p->page == page) return p;
+		return NULL;
+	}
+
+	ShadowPage *findOrCreate(ADDRINT page, THREADID tid)
+	{
+		ShadowPage *p = find(page);
+		if (p != NULL) return p;
+
+		PIN_GetLock(&m_lock, tid + 1);
+		p = find(page);			// 另一个线程可能刚插入
+		if (p == NULL)
+		{
+			p = new ShadowPage();
+			memset(p, 0, sizeof(ShadowPage));
+			p->page = page;
+			p->next = m_dir[slot(page)];
+			m_dir[slot(page)] = p;		// 页初始化完成后才发布
+			m_pages++;
+		}
+		PIN_ReleaseLock(&m_lock);
+		return p;
+	}
+
+	size_t bytes() const { return m_pages * sizeof(ShadowPage) + sizeof(m_dir); }
+
+private:
+	ShadowPage *volatile m_dir[1 << SHADOW_DIR_BITS];
+	PIN_LOCK m_lock;
+	size_t m_pages;
+
+	static UINT32 slot(ADDRINT page)
+	{
+		return (UINT32)((page * 0x9e3779b97f4a7c15ULL) >> (64 - SHADOW_DIR_BITS));
+	}
+};
+
+ShadowMemory shadow;
+
+// 距离小于此值的store->load对记为可能的store forwarding, 量级与store buffer深度相当
+static const UINT64 FORWARD_WINDOW = 64;
+
+// Per static load: how often, and how closely, it reads data stored by the same thread.
+// 计数由各线程直接累加, 多线程时是近似值; 直方图是每线程精确的
+struct LoadSite
+{
+	ADDRINT pc;
+	UINT64 deps;			// 找到同线程写者的次数
+	UINT64 forwards;		// 距离小于FORWARD_WINDOW的次数
+	UINT64 minDist;
+	UINT32 minStore;		// 距离最短的store
+};
+
+// 静态store和load, 插桩时在VM锁内分配, 代码缓存清空后重新插桩时复用
+vector<ADDRINT> storePcs;
+std::map<ADDRINT, UINT32> storeIds;
+std::map<ADDRINT, LoadSite*> loadSites;
+
+// Percentiles written to the csv
+static const double PERCENTILES[] = { 50, 90, 99, 99.9, 100 };
+
 // Global variables
-// The array storing the distance frequency between two dependant instructions
-UINT64 *insDependDistance;
 INT32 maxSize;
-INT32 insPointer = 0;
-INT32 lastInsPointer[1024] = { 0 };
+
+static const UINT32 MAX_REGS = 1024;
+
+// 每个线程独立的依赖状态, 按64字节对齐, 线程之间不共享cache line
+struct ThreadDeps
+{
+	UINT64 insPointer;
+	UINT64 noWriter;				// 之前没有写者的读
+	UINT64 lastInsPointer[MAX_REGS];
+	DistHistogram insDependDistance;	// The histogram storing the distance frequency between two dependant instructions
+
+	// 经过内存的依赖
+	ADDRINT lastPageNum;			// 最近访问的影子页, 省去目录查找
+	ShadowPage *lastPage;
+	UINT64 memNoWriter;				// 读到从未写过的granule
+	UINT64 memCrossThread;			// 最后的写者在其他线程, 指令序号不可比, 不计距离
+	DistHistogram memDependDistance;
+	UINT8 *mem;						// 未对齐的分配, Fini合并后释放
+};
+
+ThreadDeps *threadDeps[PIN_MAX_THREADS];
+
+VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+	UINT8 *mem = new UINT8[sizeof(ThreadDeps) + 63];
+	ThreadDeps *td = (ThreadDeps*)(((ADDRINT)mem + 63) & ~(ADDRINT)63);
+	memset(td, 0, sizeof(ThreadDeps));
+	td->mem = mem;
+	threadDeps[tid] = td;
+}
+
+// Count one read of reg; branch-free so that Pin can inline the specialized routines
+inline VOID recordRead(ThreadDeps *td, UINT32 reg)
+{
+	UINT64 last = td->lastInsPointer[reg];
+	UINT32 bucket = DistHistogram::bucket(td->insPointer - last - 1);
+	td->insDependDistance.counts[bucket] += last != 0;
+	td->noWriter += last == 0;
+}
+
+inline ShadowPage *shadowPage(ThreadDeps *td, THREADID tid, ADDRINT page, bool create)
+{
+	if (td->lastPage != NULL && td->lastPageNum == page) return td->lastPage;
+	ShadowPage *p = create ? shadow.findOrCreate(page, tid) : shadow.find(page);
+	if (p != NULL)
+	{
+		td->lastPageNum = page;
+		td->lastPage = p;
+	}
+	return p;
+}
+
+// Called before a load of size bytes at addr: the nearest earlier store to any of its granules is the dependency
+VOID PIN_FAST_ANALYSIS_CALL memRead(THREADID tid, ADDRINT addr, UINT32 size, VOID *v)
+{
+	ThreadDeps *td = threadDeps[tid];
+	LoadSite *site = (LoadSite*)v;
+	const ShadowEntry *nearest = NULL;
+	bool cross = false;
+	for (ADDRINT g = addr >> GRANULE_BITS; g <= (addr + size - 1) >> GRANULE_BITS; g++)
+	{
+		ShadowPage *p = shadowPage(td, tid, g >> (SHADOW_PAGE_BITS - GRANULE_BITS), false);
+		if (p == NULL) continue;
+		const ShadowEntry *e = &p->entries[g & ((1 << (SHADOW_PAGE_BITS - GRANULE_BITS)) - 1)];
+		if (e->insNum == 0) continue;
+		if (e->tid != tid) cross = true;
+		else if (nearest == NULL || e->insNum > nearest->insNum) nearest = e;
+	}
+
+	if (nearest == NULL)
+	{
+		if (cross) td->memCrossThread++;
+		else td->memNoWriter++;
+		return;
+	}
+
+	UINT64 distance = td->insPointer - nearest->insNum - 1;
+	td->memDependDistance.counts[DistHistogram::bucket(distance)]++;
+	site->deps++;
+	site->forwards += distance < FORWARD_WINDOW;
+	if (site->deps == 1 || distance < site->minDist)
+	{
+		site->minDist = distance;
+		site->minStore = nearest->store;
+	}
+}
+
+// Called before a store of size bytes at addr by static store number store
+VOID PIN_FAST_ANALYSIS_CALL memWrite(THREADID tid, ADDRINT addr, UINT32 size, UINT32 store)
+{
+	ThreadDeps *td = threadDeps[tid];
+	for (ADDRINT g = addr >> GRANULE_BITS; g <= (addr + size - 1) >> GRANULE_BITS; g++)
+	{
+		ShadowPage *p = shadowPage(td, tid, g >> (SHADOW_PAGE_BITS - GRANULE_BITS), true);
+		ShadowEntry *e = &p->entries[g & ((1 << (SHADOW_PAGE_BITS - GRANULE_BITS)) - 1)];
+		e->insNum = td->insPointer;
+		e->store = store;
+		e->tid = tid;
+	}
+}
 
 // This function is called before every instruction is executed. 
 // You have to edit this function to determine the dependency distance
 // and populate the insDependDistance data structure.
-VOID updateInsDependDistance(VOID *v)
+VOID PIN_FAST_ANALYSIS_CALL updateInsDependDistance(THREADID tid, VOID *v)
 {
+	ThreadDeps *td = threadDeps[tid];
+
 	// Update the instruction pointer
-	++insPointer;
+	++td->insPointer;
 
 	// regs contains the registers read and written by this instruction.
-	// regs->read contains the registers read.
-	// regs->write contains the registers written.
-	Registers *regs = (Registers*)v;
+	// regs->read() contains the nread registers read.
+	// regs->write() contains the nwrite registers written.
+	const Registers *regs = (const Registers*)v;
 	
 	/* TODO:
 		本函数需完成以下2个任务：	
@@ -65,36 +388,89 @@ VOID updateInsDependDistance(VOID *v)
 			10  add a ,a ,b
 			依赖上一个a而不是这个a
 	*/
-	for (vector<reg_t>::iterator it = regs->read.begin(); it != regs->read.end(); it++)
-	{
-		reg_t reg = *it;
+	const reg_t *read = regs->read();
+	for (UINT32 i = 0; i < regs->nread; i++)
+		recordRead(td, read[i]);
+	
+	// Update the lastInstructionCount for the written registers
+	const reg_t *write = regs->write();
+	for (UINT32 i = 0; i < regs->nwrite; i++)
+		td->lastInsPointer[write[i]] = td->insPointer;
+}
+
+// Specialized routine for instructions reading R and writing W registers, passed as immediates:
+// r0..r2 are the reads, w0, w1 the writes, unused ones are 0. 没有循环和分支, Pin可以内联
+template<UINT32 R, UINT32 W>
+VOID PIN_FAST_ANALYSIS_CALL updateDependFixed(THREADID tid, UINT32 r0, UINT32 r1, UINT32 r2, UINT32 w0, UINT32 w1)
+{
+	ThreadDeps *td = threadDeps[tid];
+	++td->insPointer;
+	if (R > 0) recordRead(td, r0);
+	if (R > 1) recordRead(td, r1);
+	if (R > 2) recordRead(td, r2);
+	if (W > 0) td->lastInsPointer[w0] = td->insPointer;
+	if (W > 1) td->lastInsPointer[w1] = td->insPointer;
+}
+
+static const UINT32 FIXED_READS = 3;
+static const UINT32 FIXED_WRITES = 2;
+#define DEPEND_ROW(r) { (AFUNPTR)updateDependFixed<r, 0>, (AFUNPTR)updateDependFixed<r, 1>, (AFUNPTR)updateDependFixed<r, 2> }
+static const AFUNPTR DEPEND_ROUTINES[FIXED_READS + 1][FIXED_WRITES + 1] = {
+	DEPEND_ROW(0), DEPEND_ROW(1), DEPEND_ROW(2), DEPEND_ROW(3)
+};
+
+// 为A/B比较保留通用的记录指针版本
+KNOB<BOOL> KnobSpecialize(KNOB_MODE_WRITEONCE, "pintool", "spec", "1",
+                          "use the specialized analysis routines for instructions with at most 3 reads and 2 writes");
+
+// 默认关闭: 每条访存指令都要调用不可内联的影子内存函数
+KNOB<BOOL> KnobMemory(KNOB_MODE_WRITEONCE, "pintool", "mem", "0", "also track load-after-store dependencies through memory");
 
-		if (lastInsPointer[reg] > 0)
+// 插在寄存器的分析函数之后, 此时insPointer已是当前指令; 先读后写, 读不会看到本指令的写
+VOID instrumentMemory(INS ins)
+{
+	UINT32 memOperands = INS_MemoryOperandCount(ins);
+	if (memOperands == 0 || !INS_IsStandardMemop(ins)) return;
+
+	for (UINT32 i = 0; i < memOperands; i++)
+	{
+		if (!INS_MemoryOperandIsRead(ins, i)) continue;
+		LoadSite *&site = loadSites[INS_Address(ins)];
+		if (site == NULL)
 		{
-			// Compute the dependency distance
-			INT32 distance = insPointer - lastInsPointer[*it] - 1;
+			site = new LoadSite();
+			memset(site, 0, sizeof(LoadSite));
+			site->pc = INS_Address(ins);
+		}
+		INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)memRead, IARG_FAST_ANALYSIS_CALL, IARG_THREAD_ID,
+		                         IARG_MEMORYOP_EA, i, IARG_UINT32, (UINT32)INS_MemoryOperandSize(ins, i),
+		                         IARG_PTR, (void*)site, IARG_END);
+	}
 
-			// Populate the insDependDistance array
-			if (distance <= maxSize)
-				insDependDistance[distance]++;
+	for (UINT32 i = 0; i < memOperands; i++)
+	{
+		if (!INS_MemoryOperandIsWritten(ins, i)) continue;
+		std::map<ADDRINT, UINT32>::iterator it = storeIds.find(INS_Address(ins));
+		if (it == storeIds.end())
+		{
+			it = storeIds.insert(std::make_pair(INS_Address(ins), (UINT32)storePcs.size())).first;
+			storePcs.push_back(INS_Address(ins));
 		}
+		INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)memWrite, IARG_FAST_ANALYSIS_CALL, IARG_THREAD_ID,
+		                         IARG_MEMORYOP_EA, i, IARG_UINT32, (UINT32)INS_MemoryOperandSize(ins, i),
+		                         IARG_UINT32, it->second, IARG_END);
 	}
-	
-	// Update the lastInstructionCount for the written registers
-	for (vector<reg_t>::iterator it = regs->write.begin(); it != regs->write.end(); it++)
-		lastInsPointer[*it] = insPointer;
-		
-	
 }
 
 // Pin calls this function every time a new instruction is encountered
 VOID Instruction(INS ins, VOID *v)
 {
-	// regs stores the registers read, written by this instruction
-	Registers* regs = new Registers();
+	// 先收集到栈上去重, 再按实际个数从arena分配记录
+	reg_t read[256], write[256];
+	UINT32 nread = 0, nwrite = 0;
 
 	// Find all the register written
-	for (uint32_t iw = 0; iw < INS_MaxNumWRegs(ins); iw++)
+	for (uint32_t iw = 0; iw < INS_MaxNumWRegs(ins) && nwrite < 255; iw++)
 	{
 		// 获取当前指令中被写的寄存器(即目的寄存器)
 		REG wr = INS_RegW(ins, iw);
@@ -104,12 +480,12 @@ VOID Instruction(INS ins, VOID *v)
 			continue;
     
     	// 将被写寄存器保存到regs向量当中
-		if (std::find(regs->write.begin(), regs->write.end(), wr) == regs->write.end())
-			regs->write.push_back(wr);
+		if (std::find(write, write + nwrite, (reg_t)wr) == write + nwrite)
+			write[nwrite++] = (reg_t)wr;
 	}
 
 	// Find all the registers read
-	for (uint32_t ir = 0; ir < INS_MaxNumRRegs(ins); ir++)
+	for (uint32_t ir = 0; ir < INS_MaxNumRRegs(ins) && nread < 255; ir++)
 	{
 		REG rr = INS_RegR(ins, ir);
 
@@ -117,29 +493,144 @@ VOID Instruction(INS ins, VOID *v)
 		if (!REG_valid(rr))
 			continue;
 		
-		if (std::find(regs->read.begin(), regs->read.end(), rr) == regs->read.end())
-			regs->read.push_back(rr);
+		if (std::find(read, read + nread, (reg_t)rr) == read + nread)
+			read[nread++] = (reg_t)rr;
+	}
+
+	if (KnobSpecialize.Value() && nread <= FIXED_READS && nwrite <= FIXED_WRITES)
+	{
+		// 寄存器编号作为立即数传入, 不需要记录
+		reg_t r[FIXED_READS] = { 0, 0, 0 }, w[FIXED_WRITES] = { 0, 0 };
+		std::copy(read, read + nread, r);
+		std::copy(write, write + nwrite, w);
+		INS_InsertCall(ins, IPOINT_BEFORE, DEPEND_ROUTINES[nread][nwrite], IARG_FAST_ANALYSIS_CALL,
+		               IARG_THREAD_ID, IARG_UINT32, (UINT32)r[0], IARG_UINT32, (UINT32)r[1], IARG_UINT32, (UINT32)r[2],
+		               IARG_UINT32, (UINT32)w[0], IARG_UINT32, (UINT32)w[1], IARG_END);
+	}
+	else
+	{
+		// regs stores the registers read, written by this instruction
+		Registers* regs = regArena.alloc(nread + nwrite);
+		regs->nread = (UINT8)nread;
+		regs->nwrite = (UINT8)nwrite;
+		std::copy(read, read + nread, regs->regs);
+		std::copy(write, write + nwrite, regs->regs + nread);
+
+		// Insert a call to the analysis function -- updateInsDependDistance -- before every instruction.
+		// Pass the regs structure to the analysis function.
+		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)updateInsDependDistance, IARG_FAST_ANALYSIS_CALL,
+		               IARG_THREAD_ID, IARG_PTR, (void*)regs, IARG_END);
 	}
 
-	// Insert a call to the analysis function -- updateInsDependDistance -- before every instruction.
-	// Pass the regs structure to the analysis function.
-	INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)updateInsDependDistance, IARG_PTR, (void*)regs, IARG_END);
+	if (KnobMemory.Value()) instrumentMemory(ins);
+}
+
+// Pin calls this function after the code cache is flushed; no instrumented code refers to the records any more
+VOID CacheFlushed(VOID *v)
+{
+	cacheFlushes++;
+	regArena.reset();
 }
 
 // This knob sets the output file name
 KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o", "insDependDist.csv", "specify the output file name");
 
-// This knob will set the maximum distance between two dependant instructions in the program
-KNOB<string> KnobMaxDistance(KNOB_MODE_WRITEONCE, "pintool", "s", "100", "specify the maximum distance between two dependant instructions in the program");
+// This knob sets how many exact distances go to the first csv row; the histogram itself keeps every distance
+KNOB<string> KnobMaxDistance(KNOB_MODE_WRITEONCE, "pintool", "s", "100", "specify the number of exact distances written to the first csv row (at most 128)");
+
+// Output of the memory dependencies: a csv in the same format, and the load sites with the most short store->load pairs
+KNOB<string> KnobMemOutputFile(KNOB_MODE_WRITEONCE, "pintool", "omem", "insDependDistMem.csv", "specify the memory dependency csv");
+KNOB<string> KnobMemSitesFile(KNOB_MODE_WRITEONCE, "pintool", "omemsites", "insDependDistMemSites.txt",
+                              "specify the report of the loads with the shortest store-to-load distances");
+KNOB<UINT32> KnobTopN(KNOB_MODE_WRITEONCE, "pintool", "topn", "20", "number of loads in the memory dependency report");
+
+// 第一行与之前相同, 为距离0到-s - 1的计数; 之后是百分位和完整直方图的非空桶
+VOID writeHistogram(ofstream &out, const DistHistogram &h)
+{
+    out.setf(ios::showbase);
+    for (INT32 i = 0; i < maxSize; i++)
+	    out << h.counts[i] << ",";
+    out << endl << "percentile";
+    for (size_t i = 0; i < sizeof(PERCENTILES) / sizeof(PERCENTILES[0]); i++)
+        out << "," << PERCENTILES[i];
+    out << endl << "distance";
+    for (size_t i = 0; i < sizeof(PERCENTILES) / sizeof(PERCENTILES[0]); i++)
+        out << "," << h.percentile(PERCENTILES[i]);
+    out << endl << "bucket_low";
+    for (UINT32 b = 0; b < HIST_BUCKETS; b++)
+        if (h.counts[b]) out << "," << DistHistogram::lower(b);
+    out << endl << "bucket_count";
+    for (UINT32 b = 0; b < HIST_BUCKETS; b++)
+        if (h.counts[b]) out << "," << h.counts[b];
+    out << endl;
+}
+
+// store forwarding最多的load在前, 相同时最短距离小的在前
+bool cmpLoadSite(const LoadSite *a, const LoadSite *b)
+{
+    if (a->forwards != b->forwards) return a->forwards > b->forwards;
+    return a->minDist < b->minDist;
+}
+
+VOID writeLoadSites(ofstream &out)
+{
+    vector<LoadSite*> sites;
+    for (std::map<ADDRINT, LoadSite*>::iterator it = loadSites.begin(); it != loadSites.end(); it++)
+        if (it->second->deps) sites.push_back(it->second);
+    std::sort(sites.begin(), sites.end(), cmpLoadSite);
+
+    out << "Loads with the most store->load distances below " << FORWARD_WINDOW << " instructions ("
+        << sites.size() << " loads read data stored by the same thread)" << endl;
+    out << "load pc            nearest store pc   min distance   short pairs     all pairs" << endl;
+    for (size_t i = 0; i < sites.size() && i < KnobTopN.Value(); i++)
+    {
+        const LoadSite *s = sites[i];
+        out << "0x" << std::hex << std::setw(16) << std::setfill('0') << s->pc
+            << " 0x" << std::setw(16) << storePcs[s->minStore] << std::dec << std::setfill(' ')
+            << std::setw(14) << s->minDist << std::setw(14) << s->forwards << std::setw(14) << s->deps << endl;
+    }
+}
 
 // This function is called when the application exits
 VOID Fini(INT32 code, VOID *v)
 {
+	// 合并各线程的分布
+	static DistHistogram insDependDistance, memDependDistance;
+	UINT64 instructions = 0, noWriter = 0, memNoWriter = 0, memCrossThread = 0;
+	for (THREADID t = 0; t < PIN_MAX_THREADS; t++)
+	{
+		if (threadDeps[t] == NULL) continue;
+		insDependDistance.merge(threadDeps[t]->insDependDistance);
+		memDependDistance.merge(threadDeps[t]->memDependDistance);
+		instructions += threadDeps[t]->insPointer;
+		noWriter += threadDeps[t]->noWriter;
+		memNoWriter += threadDeps[t]->memNoWriter;
+		memCrossThread += threadDeps[t]->memCrossThread;
+		delete[] threadDeps[t]->mem;
+		threadDeps[t] = NULL;
+	}
+
 	// Write to a file since cout and cerr maybe closed by the application
-    OutFile.setf(ios::showbase);
-    for (INT32 i = 0; i < maxSize; i++)
-	    OutFile << insDependDistance[i] << ",";
+    writeHistogram(OutFile, insDependDistance);
     OutFile.close();
+
+    if (KnobMemory.Value())
+    {
+        ofstream memOut(KnobMemOutputFile.Value().c_str());
+        writeHistogram(memOut, memDependDistance);
+        ofstream sitesOut(KnobMemSitesFile.Value().c_str());
+        writeLoadSites(sitesOut);
+    }
+
+    cerr << "insDependDist: " << instructions << " instructions, " << insDependDistance.total()
+         << " register dependencies, " << noWriter << " reads without an earlier writer" << endl;
+    if (KnobMemory.Value())
+        cerr << "insDependDist: " << memDependDistance.total() << " store->load dependencies, " << memNoWriter
+             << " loads of never-stored memory, " << memCrossThread << " loads of data stored by another thread, shadow memory "
+             << shadow.bytes() / 1024 << " KB" << endl;
+
+    cerr << "insDependDist: register records " << regArena.bytes() / 1024 << " KB, "
+         << cacheFlushes << " code cache flushes" << endl;
 }
 
 /* ===================================================================== */
@@ -166,14 +657,21 @@ int main(int argc, char * argv[])
     
     OutFile.open(KnobOutputFile.Value().c_str());
     maxSize = atoi(KnobMaxDistance.Value().c_str());
+    if (maxSize < 0 || maxSize > (INT32)HIST_EXACT)
+    {
+        cerr << "-s must be between 0 and " << HIST_EXACT << ", longer distances are in the log buckets" << endl;
+        return Usage();
+    }
 
-    // Initializing depdendancy Distance
-    insDependDistance = new UINT64[maxSize];
-    memset((void*)insDependDistance, 0, sizeof(UINT64) * maxSize);
+    // Dependency distances are counted per thread, see ThreadStart
+    PIN_AddThreadStartFunction(ThreadStart, 0);
 
     // Register Instruction to be called to instrument instructions
     INS_AddInstrumentFunction(Instruction, 0);
 
+    // Reclaim the register records together with the code that uses them
+    CODECACHE_AddCacheFlushedFunction(CacheFlushed, 0);
+
     // Register Fini to be called when the application exits
     PIN_AddFiniFunction(Fini, 0);
     
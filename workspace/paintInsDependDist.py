@@ -18,6 +18,16 @@ with open(filename) as f:
 	for i in range(MAX_DISPLAY):
 		percent.append(int(depend_row[i]) / allDepend)
 
+	# 之后的行: percentile, distance, bucket_low, bucket_count (旧版输出没有这些行)
+	extra = {row[0]: row[1:] for row in reader if row}
+
+percentiles = []
+if 'percentile' in extra and 'distance' in extra:
+	percentiles = list(zip(extra['percentile'], [int(d) for d in extra['distance']]))
+	print('dependence distance percentiles:')
+	for p, d in percentiles:
+		print('  p%-5s %d' % (p, d))
+
 fig = plt.figure(dpi = 100, figsize = (7, 4))
 plt.plot([n for n in range(1, MAX_DISPLAY + 1)], percent[0:MAX_DISPLAY], c = 'red', marker = '.')
 
@@ -25,6 +35,12 @@ plt.title("Instuction Dependance Distance Distribution", fontsize = 16)
 plt.xlabel('Dependence Distance', fontsize = 12)
 plt.ylabel('Percent of Dependence', fontsize = 12)
 
+# 标出显示范围内的百分位
+for p, d in percentiles:
+	if d < MAX_DISPLAY:
+		plt.axvline(d + 1, c = 'gray', linestyle = '--', linewidth = 0.8)
+		plt.text(d + 1, percent[0], ' p' + p, fontsize = 8, color = 'gray', va = 'top')
+
 plt.xlim(0, MAX_DISPLAY)
 plt.ylim(0, percent[0] * 1.05)
 
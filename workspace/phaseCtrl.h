@@ -0,0 +1,305 @@
+/**************************************
+ * Fast-forward / warm-up / measure control
+ * shared by cacheModel and brchPredict
+ *
+ * FASTFORWARD: 只插入每个BBL的指令计数, 模型不运行
+ * WARMUP:      模型正常运行, 但统计结果在进入MEASURE时清零
+ * MEASURE:     统计结果有效; 运行完指定条数后输出结果并detach
+ *
+ * 默认只有一个测量区间 (-ff, -warm, -measure).
+ * 给出-sp/-spw时, 依次模拟SimPoint选出的各个区间, 每个区间结束时
+ * 工具按权重累加统计结果, 最后输出重建的全程序结果.
+**************************************/
+#ifndef PHASE_CTRL_H
+#define PHASE_CTRL_H
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include "pin.H"
+
+KNOB<UINT64> KnobFastForward(KNOB_MODE_WRITEONCE, "pintool",
+        "ff", "0", "specify the number of instructions to fast-forward with instrumentation removed");
+
+KNOB<UINT64> KnobWarmup(KNOB_MODE_WRITEONCE, "pintool",
+        "warm", "0", "specify the number of instructions to warm up the models without counting");
+
+KNOB<UINT64> KnobMeasure(KNOB_MODE_WRITEONCE, "pintool",
+        "measure", "0", "specify the number of instructions to measure before detaching, 0 for until exit");
+
+KNOB<std::string> KnobSimPoints(KNOB_MODE_WRITEONCE, "pintool",
+        "sp", "", "specify the .simpoints file; only the listed intervals are simulated");
+
+KNOB<std::string> KnobSimPointWeights(KNOB_MODE_WRITEONCE, "pintool",
+        "spw", "", "specify the .weights file matching -sp");
+
+KNOB<UINT64> KnobSimPointInterval(KNOB_MODE_WRITEONCE, "pintool",
+        "spi", "100000000", "specify the interval length used by bbvProfile");
+
+class PhaseCtrl
+{
+public:
+    enum Phase { FASTFORWARD, WARMUP, MEASURE, DONE };
+
+    PhaseCtrl() : m_phase(MEASURE), m_left(0), m_phase_start(0), m_phase_len(0), m_warm_start(0), m_cur(0),
+                  m_instrumented(0), m_resume(false), m_resume_pos(0), m_track(false), m_period(0), m_tick(UNLIMITED), m_periodic(NULL),
+                  m_begin(NULL), m_end_region(NULL), m_end(NULL) {}
+
+    // Call before init: continue a run restored from a checkpoint taken at instruction pos.
+    // The application is fast-forwarded to pos and measured without warm-up or clearing the restored statistics.
+    void resumeAt(UINT64 pos)
+    {
+        m_resume = true;
+        m_resume_pos = pos;
+    }
+
+    // Call before init: keep counting instructions even when no phase change is pending, so that position() stays exact
+    void trackPosition() { m_track = true; }
+
+    // Call before init: invoke cb with the current position every period instructions while the models run
+    void setPeriodic(UINT64 period, void (*cb)(UINT64))
+    {
+        m_period = period;
+        m_tick = period;
+        m_periodic = cb;
+    }
+
+    // Call after PIN_Init
+    // param:   begin_measure:  called when a measurement window starts, the tool should reset its statistics
+    //          end_region:     called with the region's weight when a simulation point ends (-sp only),
+    //                          the tool should accumulate its weighted statistics
+    //          end_measure:    called when measuring ends before the application exits, the tool should dump its results
+    void init(void (*begin_measure)(), void (*end_region)(double), void (*end_measure)())
+    {
+        m_begin = begin_measure;
+        m_end_region = end_region;
+        m_end = end_measure;
+        PIN_InitLock(&m_lock);
+
+        if (sampling())
+        {
+            loadSimPoints();
+        }
+        else if (m_resume)
+        {
+            Region r = { m_resume_pos, KnobMeasure.Value(), 1.0 };
+            m_regions.push_back(r);
+        }
+        else
+        {
+            Region r = { KnobFastForward.Value() + KnobWarmup.Value(), KnobMeasure.Value(), 1.0 };
+            m_regions.push_back(r);
+        }
+
+        m_cur = 0;
+        startRegion(0);
+        settle();
+
+        TRACE_AddInstrumentFunction(instrumentTrace, this);
+    }
+
+    Phase phase() { return m_phase; }
+
+    // Whether the tool should insert its analysis calls
+    bool instrumenting() { return m_phase == WARMUP || m_phase == MEASURE; }
+
+    // Whether statistics are being counted, i.e. the results at exit are valid
+    bool measuring() { return m_phase == MEASURE; }
+
+    // Whether the results are reconstructed from simulation points
+    bool sampling() { return !KnobSimPoints.Value().empty(); }
+
+    UINT32 numRegions() { return m_regions.size(); }
+
+    // Number of instructions executed so far (approximate at BBL granularity)
+    UINT64 position() { return m_phase_start + (m_phase_len - m_left); }
+
+    // Number of instructions executed while instrumenting(), i.e. those the tool's analysis calls have seen;
+    // needs trackPosition() to stay exact once the last phase change has passed
+    UINT64 instrumented() { return m_instrumented + (instrumenting() ? m_phase_len - m_left : 0); }
+
+    // Call from Fini: a simulation point cut short by the exit still contributes its weight
+    void atExit()
+    {
+        if (sampling() && m_phase == MEASURE && m_end_region) m_end_region(m_regions[m_cur].weight);
+    }
+
+private:
+    static const INT64 UNLIMITED = 0x7fffffffffffffffLL;
+
+    // A measurement window, in instructions from the start of the program
+    struct Region
+    {
+        UINT64 start;
+        UINT64 length;          // 0: until exit
+        double weight;
+    };
+
+    Phase m_phase;
+    INT64 m_left;               // 当前阶段剩余的指令数
+    UINT64 m_phase_start;       // 当前阶段开始的位置
+    INT64 m_phase_len;          // 当前阶段的长度, 即进入时的m_left
+    UINT64 m_warm_start;        // 当前区间预热开始的位置
+    std::vector<Region> m_regions;
+    UINT32 m_cur;               // 当前区间
+    UINT64 m_instrumented;      // 已结束的预热/测量阶段执行的指令数
+    bool m_resume;
+    UINT64 m_resume_pos;
+    bool m_track;               // 不需要切换阶段时也计数
+    UINT64 m_period;            // 周期回调的间隔, 0为不回调
+    INT64 m_tick;               // 距离下一次周期回调的指令数
+    void (*m_periodic)(UINT64);
+    void (*m_begin)();
+    void (*m_end_region)(double);
+    void (*m_end)();
+    PIN_LOCK m_lock;            // advance可能在多个线程同时触发
+
+    static bool cmpRegion(const Region& a, const Region& b) { return a.start < b.start; }
+
+    // Read SimPoint's "<interval> <cluster>" and "<weight> <cluster>" files
+    void loadSimPoints()
+    {
+        std::vector<double> weights;
+        FILE* fw = fopen(KnobSimPointWeights.Value().c_str(), "r");
+        double w;
+        UINT32 cluster;
+        while (fw && fscanf(fw, "%lf %u", &w, &cluster) == 2)
+        {
+            if (cluster >= weights.size()) weights.resize(cluster + 1, 0);
+            weights[cluster] = w;
+        }
+        if (fw) fclose(fw);
+
+        FILE* fs = fopen(KnobSimPoints.Value().c_str(), "r");
+        UINT64 idx;
+        while (fs && fscanf(fs, "%lu %u", &idx, &cluster) == 2)
+        {
+            Region r = { idx * KnobSimPointInterval.Value(), KnobSimPointInterval.Value(),
+                         cluster < weights.size() ? weights[cluster] : 0 };
+            m_regions.push_back(r);
+        }
+        if (fs) fclose(fs);
+
+        if (m_regions.empty())
+        {
+            fprintf(stderr, "phaseCtrl: no simulation points read from %s\n", KnobSimPoints.Value().c_str());
+            PIN_ExitApplication(1);
+        }
+        std::sort(m_regions.begin(), m_regions.end(), cmpRegion);
+    }
+
+    // Fast-forward from pos to the warm-up window of m_regions[m_cur]
+    void startRegion(UINT64 pos)
+    {
+        const Region& r = m_regions[m_cur];
+        UINT64 warm = m_resume ? 0 : KnobWarmup.Value();
+        m_warm_start = r.start > warm ? r.start - warm : 0;
+        if (m_warm_start < pos) m_warm_start = pos;     // 与上一个区间重叠
+
+        m_phase = FASTFORWARD;
+        m_left = m_warm_start - pos;
+        m_phase_start = pos;
+        m_phase_len = m_left;
+    }
+
+    // Move to the next phase; the small overshoot of the last BBL is ignored
+    void next()
+    {
+        const Region& r = m_regions[m_cur];
+        if (instrumenting()) m_instrumented += m_phase_len - m_left;
+        switch (m_phase)
+        {
+            case FASTFORWARD:
+                m_phase = WARMUP;
+                m_left = r.start > m_warm_start ? r.start - m_warm_start : 0;
+                m_phase_start = m_warm_start;
+                m_phase_len = m_left;
+                break;
+            case WARMUP:
+                m_phase = MEASURE;
+                m_left = r.length ? (INT64)r.length : UNLIMITED;
+                m_phase_start = r.start;
+                m_phase_len = m_left;
+                if (m_begin && !m_resume) m_begin();
+                m_resume = false;
+                break;
+            case MEASURE:
+                if (sampling() && m_end_region) m_end_region(r.weight);
+                if (++m_cur < m_regions.size()) startRegion(r.start + r.length);
+                else m_phase = DONE;
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Skip phases of zero length
+    void settle()
+    {
+        while (m_phase != DONE && m_left == 0) next();
+        if (m_phase == DONE) m_left = UNLIMITED;
+    }
+
+    // Whether the current phase runs until the application exits
+    bool endless() { return m_phase == DONE || (m_phase == MEASURE && m_regions[m_cur].length == 0); }
+
+    // Called once the instruction budget of the current phase or of the periodic callback has been used up.
+    // m_left和m_tick由所有线程共享, 几个线程可能同时看到预算用完; 在锁内重新检查, 只有第一个线程切换阶段
+    static VOID advance(PhaseCtrl* pc, THREADID tid)
+    {
+        PIN_GetLock(&pc->m_lock, tid + 1);
+        pc->advanceLocked();
+        PIN_ReleaseLock(&pc->m_lock);
+    }
+
+    void advanceLocked()
+    {
+        if (m_period && m_tick <= 0)
+        {
+            m_tick += m_period;
+            if (instrumenting()) m_periodic(position());
+        }
+
+        // Detaching is asynchronous, some analysis calls may still arrive
+        if (endless() || m_left > 0) return;
+
+        bool was_instrumenting = instrumenting();
+        next();
+        settle();
+
+        if (m_phase == DONE)
+        {
+            if (m_end) m_end();
+            PIN_Detach();
+        }
+        else if (was_instrumenting != instrumenting())
+        {
+            // Re-instrument the code so that the tool's analysis calls get inserted or removed
+            PIN_RemoveInstrumentation();
+        }
+    }
+
+    static ADDRINT PIN_FAST_ANALYSIS_CALL countdown(PhaseCtrl* pc, UINT32 ninst)
+    {
+        pc->m_left -= ninst;
+        pc->m_tick -= ninst;
+        return (pc->m_left <= 0) | (pc->m_tick <= 0);
+    }
+
+    static VOID instrumentTrace(TRACE trace, VOID* v)
+    {
+        PhaseCtrl* pc = (PhaseCtrl*)v;
+        if (pc->m_phase == DONE || (pc->endless() && !pc->m_period && !pc->m_track)) return;
+
+        for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+        {
+            BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)countdown, IARG_FAST_ANALYSIS_CALL,
+                             IARG_PTR, pc, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+            BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)advance, IARG_PTR, pc, IARG_THREAD_ID, IARG_END);
+        }
+    }
+};
+
+PhaseCtrl phaseCtrl;
+
+#endif
@@ -0,0 +1,108 @@
+# Offline SimPoint clustering of the basic-block vectors written by bbvProfile
+# usage: python3 simPoint.py [bbvProfile.bb] [maxK]
+# output: <name>.simpoints ("<interval> <cluster>") and <name>.weights ("<weight> <cluster>"),
+#         passed to cacheModel/brchPredict through -sp and -spw
+
+import sys
+import math
+import numpy as np
+
+filename = sys.argv[1] if len(sys.argv) >= 2 else 'bbvProfile.bb'
+MAX_K = int(sys.argv[2]) if len(sys.argv) >= 3 else 30
+DIM = 15                # dimensions after random projection
+SEEDS = 5               # k-means restarts per k
+BIC_THRESHOLD = 0.9     # pick the smallest k whose BIC reaches 90% of the observed range
+ITERATIONS = 100
+
+rng = np.random.RandomState(42)
+
+# Read the vectors and project them onto DIM random dimensions
+# Projection matrix columns are generated lazily per basic block id, so the full vectors are never stored
+proj = {}
+rows = []
+with open(filename) as f:
+	for line in f:
+		if not line.startswith('T'):
+			continue
+		vec = np.zeros(DIM)
+		total = 0
+		for item in line[1:].split():
+			_, bbl, cnt = item.split(':')
+			bbl = int(bbl)
+			cnt = int(cnt)
+			if bbl not in proj:
+				proj[bbl] = rng.uniform(-1, 1, DIM)
+			vec += cnt * proj[bbl]
+			total += cnt
+		rows.append(vec / total if total else vec)
+
+data = np.array(rows)
+n = len(data)
+if n == 0:
+	sys.exit('no intervals in ' + filename)
+
+def kmeans(k, seed):
+	r = np.random.RandomState(seed)
+	centers = data[r.choice(n, k, replace=False)]
+	labels = np.zeros(n, dtype=int)
+	for it in range(ITERATIONS):
+		dist = ((data[:, None, :] - centers[None, :, :]) ** 2).sum(axis=2)
+		new_labels = dist.argmin(axis=1)
+		if it > 0 and (new_labels == labels).all():
+			break
+		labels = new_labels
+		for c in range(k):
+			members = data[labels == c]
+			if len(members):
+				centers[c] = members.mean(axis=0)
+	sse = ((data - centers[labels]) ** 2).sum()
+	return centers, labels, sse
+
+# Bayesian information criterion of a clustering (Pelleg & Moore, as used by SimPoint)
+def bic(labels, sse, k):
+	if n <= k:
+		return -math.inf
+	variance = sse / (DIM * (n - k))
+	if variance <= 0:
+		return math.inf
+	loglike = 0
+	for c in range(k):
+		rn = (labels == c).sum()
+		if rn == 0:
+			continue
+		loglike += (rn * math.log(rn) - rn * math.log(n)
+		            - rn * DIM / 2 * math.log(2 * math.pi * variance) - (rn - 1) * DIM / 2)
+	params = (k - 1) + DIM * k + 1
+	return loglike - params / 2 * math.log(n)
+
+results = []
+for k in range(1, min(MAX_K, n) + 1):
+	best = None
+	for seed in range(SEEDS):
+		centers, labels, sse = kmeans(k, seed)
+		if best is None or sse < best[2]:
+			best = (centers, labels, sse)
+	results.append((k, bic(best[1], best[2], k)) + best)
+
+scores = [r[1] for r in results if math.isfinite(r[1])]
+lo, hi = (min(scores), max(scores)) if scores else (0, 0)
+chosen = results[-1]
+for r in results:
+	if not math.isfinite(r[1]) or r[1] >= lo + BIC_THRESHOLD * (hi - lo):
+		chosen = r
+		break
+
+k, score, centers, labels, sse = chosen
+base = filename.rsplit('.', 1)[0]
+with open(base + '.simpoints', 'w') as fs, open(base + '.weights', 'w') as fw:
+	cluster = 0
+	for c in range(k):
+		members = np.where(labels == c)[0]
+		if len(members) == 0:
+			continue
+		dist = ((data[members] - centers[c]) ** 2).sum(axis=1)
+		fs.write('%d %d\n' % (members[dist.argmin()], cluster))
+		fw.write('%.6f %d\n' % (len(members) / n, cluster))
+		cluster += 1
+
+print('%d intervals, k = %d, BIC = %.2f' % (n, k, score))